@@ -0,0 +1,172 @@
+/*
+ icb-capture.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "signals.h"
+#include "commands.h"
+#include "misc.h"
+
+#include "icb-commands.h"
+#include "icb-servers.h"
+#include "icb-capture.h"
+
+/* stdio buffer size, the data is written out when it fills up */
+#define CAPTURE_BUFFER_SIZE 65536
+
+static void put_uint(unsigned char *buf, guint64 value, int size)
+{
+	while (size-- > 0) {
+		buf[size] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+int icb_capture_open(ICB_SERVER_REC *server, const char *path)
+{
+	ICB_CAPTURE_REC *rec;
+	unsigned char header[ICB_CAPTURE_MAGIC_LEN+1];
+	FILE *file;
+
+	g_return_val_if_fail(IS_ICB_SERVER(server), FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	icb_capture_close(server);
+
+	file = fopen(path, "wb");
+	if (file == NULL)
+		return FALSE;
+	setvbuf(file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+	memcpy(header, ICB_CAPTURE_MAGIC, ICB_CAPTURE_MAGIC_LEN);
+	header[ICB_CAPTURE_MAGIC_LEN] = ICB_CAPTURE_VERSION;
+	fwrite(header, sizeof(header), 1, file);
+
+	rec = g_new0(ICB_CAPTURE_REC, 1);
+	rec->path = g_strdup(path);
+	rec->file = file;
+	rec->started = g_get_monotonic_time();
+	server->capture = rec;
+	return TRUE;
+}
+
+void icb_capture_close(ICB_SERVER_REC *server)
+{
+	ICB_CAPTURE_REC *rec;
+
+	rec = server->capture;
+	if (rec == NULL)
+		return;
+
+	if (fclose(rec->file) != 0)
+		g_warning("capture %s: %s", rec->path, g_strerror(errno));
+
+	server->capture = NULL;
+	g_free(rec->path);
+	g_free(rec);
+}
+
+void icb_capture_write(ICB_SERVER_REC *server, int direction,
+		       const void *data, int len)
+{
+	ICB_CAPTURE_REC *rec;
+	unsigned char header[ICB_CAPTURE_HEADER_LEN];
+
+	rec = server->capture;
+	put_uint(header, g_get_monotonic_time() - rec->started, 8);
+	header[8] = direction;
+	put_uint(header+9, len, 4);
+
+	if (fwrite(header, sizeof(header), 1, rec->file) != 1 ||
+	    fwrite(data, len, 1, rec->file) != 1) {
+		g_warning("capture %s: %s", rec->path, g_strerror(errno));
+		icb_capture_close(server);
+		return;
+	}
+
+	rec->records++;
+	rec->bytes += len;
+}
+
+/* SYNTAX: ICB CAPTURE OPEN <file> */
+static void cmd_icb_capture_open(const char *data, ICB_SERVER_REC *server)
+{
+	char *fname, *path;
+	void *free_arg;
+
+	CMD_ICB_SERVER(server);
+
+	if (!cmd_get_params(data, &free_arg, 1, &fname))
+		return;
+	if (*fname == '\0')
+		cmd_param_error(CMDERR_NOT_ENOUGH_PARAMS);
+
+	path = convert_home(fname);
+	if (!icb_capture_open(server, path)) {
+		g_free(path);
+		cmd_params_free(free_arg);
+		cmd_return_error(CMDERR_ERRNO);
+	}
+
+	g_free(path);
+	cmd_params_free(free_arg);
+}
+
+/* SYNTAX: ICB CAPTURE CLOSE */
+static void cmd_icb_capture_close(const char *data, ICB_SERVER_REC *server)
+{
+	CMD_ICB_SERVER(server);
+
+	icb_capture_close(server);
+}
+
+static void cmd_icb_capture(const char *data, ICB_SERVER_REC *server,
+			    void *item)
+{
+	CMD_ICB_SERVER(server);
+
+	command_runsub("icb capture", data, server, item);
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	if (!IS_ICB_SERVER(server))
+		return;
+
+	icb_capture_close(server);
+}
+
+void icb_capture_init(void)
+{
+	signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+
+	command_bind_icb("icb capture", NULL, (SIGNAL_FUNC) cmd_icb_capture);
+	command_bind_icb("icb capture open", NULL,
+			 (SIGNAL_FUNC) cmd_icb_capture_open);
+	command_bind_icb("icb capture close", NULL,
+			 (SIGNAL_FUNC) cmd_icb_capture_close);
+}
+
+void icb_capture_deinit(void)
+{
+	signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+
+	command_unbind("icb capture", (SIGNAL_FUNC) cmd_icb_capture);
+	command_unbind("icb capture open", (SIGNAL_FUNC) cmd_icb_capture_open);
+	command_unbind("icb capture close",
+		       (SIGNAL_FUNC) cmd_icb_capture_close);
+}
@@ -0,0 +1,50 @@
+#ifndef __ICB_CAPTURE_H
+#define __ICB_CAPTURE_H
+
+/*
+ * Binary capture of the raw data sent to and received from the server.
+ *
+ * file:   "ICBCAP" 0x00 <version>
+ * record: 8 bytes  usecs since the capture was started
+ *         1 byte   direction, ICB_CAPTURE_IN or ICB_CAPTURE_OUT
+ *         4 bytes  length of data
+ *         data     exactly as it was read or written, 256 byte blocks
+ *                  and length bytes included
+ *
+ * All integers are big-endian.
+ */
+#define ICB_CAPTURE_MAGIC "ICBCAP\0"
+#define ICB_CAPTURE_MAGIC_LEN 7
+#define ICB_CAPTURE_VERSION 1
+#define ICB_CAPTURE_HEADER_LEN 13
+
+#define ICB_CAPTURE_IN 0
+#define ICB_CAPTURE_OUT 1
+
+/* Record data if capturing is enabled for server */
+#define icb_capture(server, direction, data, len) \
+	G_STMT_START { \
+	  if ((server)->capture != NULL) \
+	    icb_capture_write(server, direction, data, len); \
+	} G_STMT_END
+
+struct _ICB_CAPTURE_REC {
+	char *path;
+	FILE *file;
+	gint64 started;
+
+	unsigned long records, bytes;
+};
+
+/* Start capturing server's traffic to path. Returns FALSE if the file
+   couldn't be created. */
+int icb_capture_open(ICB_SERVER_REC *server, const char *path);
+void icb_capture_close(ICB_SERVER_REC *server);
+
+void icb_capture_write(ICB_SERVER_REC *server, int direction,
+		       const void *data, int len);
+
+void icb_capture_init(void);
+void icb_capture_deinit(void);
+
+#endif
@@ -20,10 +20,15 @@
 
 #include "module.h"
 #include "signals.h"
+#include "settings.h"
 
 #include "icb-channels.h"
+#include "icb-nicklist.h"
 #include "icb-protocol.h"
 
+static int group_cache_size;
+static time_t group_cache_time;
+
 /* Create new ICB channel record */
 ICB_CHANNEL_REC *icb_channel_create(ICB_SERVER_REC *server, const char *name,
 				    const char *visible_name, int automatic)
@@ -39,16 +44,124 @@ ICB_CHANNEL_REC *icb_channel_create(ICB_SERVER_REC *server, const char *name,
 	return rec;
 }
 
+static void group_cache_free(ICB_GROUP_CACHE_REC *rec)
+{
+	g_free(rec->name);
+	g_free(rec->topic);
+	g_free(rec->topic_by);
+	g_ptr_array_free(rec->nicks, TRUE);
+	g_string_chunk_free(rec->pool);
+	g_free(rec);
+}
+
+static void group_cache_save(ICB_SERVER_REC *server, ICB_CHANNEL_REC *group)
+{
+	ICB_GROUP_CACHE_REC *rec;
+	GSList *nicks, *tmp, *last;
+	NICK_REC *nick;
+	char *flagged;
+
+	if (group_cache_size <= 0 || group->sync_time == 0)
+		return;
+
+	rec = g_new0(ICB_GROUP_CACHE_REC, 1);
+	rec->name = g_strdup(group->name);
+	rec->topic = g_strdup(group->topic);
+	rec->topic_by = g_strdup(group->topic_by);
+	rec->topic_time = group->topic_time;
+	rec->synced = group->sync_time;
+
+	rec->pool = g_string_chunk_new(4096);
+	nicks = nicklist_getnicks(CHANNEL(group));
+	rec->nicks = g_ptr_array_sized_new(g_slist_length(nicks));
+	for (tmp = nicks; tmp != NULL; tmp = tmp->next) {
+		nick = tmp->data;
+		flagged = g_strconcat(nick->op ? "*" : " ", nick->nick, NULL);
+		g_ptr_array_add(rec->nicks,
+				g_string_chunk_insert(rec->pool, flagged));
+		g_free(flagged);
+	}
+	g_slist_free(nicks);
+
+	server->group_cache = g_slist_prepend(server->group_cache, rec);
+
+	/* drop the least recently left */
+	if ((int) g_slist_length(server->group_cache) > group_cache_size) {
+		last = g_slist_last(server->group_cache);
+		group_cache_free(last->data);
+		server->group_cache =
+			g_slist_delete_link(server->group_cache, last);
+	}
+}
+
+static ICB_GROUP_CACHE_REC *group_cache_take(ICB_SERVER_REC *server,
+					     const char *name)
+{
+	ICB_GROUP_CACHE_REC *rec;
+	GSList *tmp;
+
+	for (tmp = server->group_cache; tmp != NULL; tmp = tmp->next) {
+		rec = tmp->data;
+		if (g_strcasecmp(rec->name, name) == 0) {
+			server->group_cache =
+				g_slist_delete_link(server->group_cache, tmp);
+			return rec;
+		}
+	}
+	return NULL;
+}
+
+/* Fill the group from the cache, the /who sync after joining only
+   applies what changed since */
+static void group_cache_restore(ICB_SERVER_REC *server, ICB_CHANNEL_REC *group,
+				ICB_GROUP_CACHE_REC *rec)
+{
+	const char *nick;
+	int i;
+
+	if (rec->topic != NULL) {
+		group->topic = g_strdup(rec->topic);
+		group->topic_by = g_strdup(rec->topic_by);
+		group->topic_time = rec->topic_time;
+		signal_emit("channel topic changed", 1, group);
+	}
+
+	for (i = 0; i < (int) rec->nicks->len; i++) {
+		nick = g_ptr_array_index(rec->nicks, i);
+		icb_nicklist_insert(group, nick+1, *nick == '*');
+	}
+}
+
 void icb_change_channel(ICB_SERVER_REC *server, const char *channel,
 			int automatic)
 {
+	ICB_GROUP_CACHE_REC *rec;
+	gint64 now;
+
 	if (g_strcasecmp(server->group->name, channel) == 0)
 		return;
 
+	now = g_get_monotonic_time();
+	server->group_switched = now;
+	server->group_shown = FALSE;
+	server->group_switches++;
+
+	group_cache_save(server, server->group);
 	channel_destroy(CHANNEL(server->group));
 	server->group = (ICB_CHANNEL_REC *)
 		icb_channel_create(server, channel, NULL, automatic);
 
+	rec = group_cache_take(server, channel);
+	if (rec != NULL && time(NULL) - rec->synced <= group_cache_time) {
+		group_cache_restore(server, server->group, rec);
+		server->group_cache_hits++;
+		server->group_shown = TRUE;
+		server->group_shows++;
+		server->group_show_time += g_get_monotonic_time() - now;
+	}
+	if (rec != NULL)
+		group_cache_free(rec);
+
         icb_command(server, "g", channel, NULL);
 }
 
@@ -63,12 +176,62 @@ static void sig_connected(ICB_SERVER_REC *server)
 				   NULL, TRUE);
 }
 
+/* The /who after changing group is done */
+static void sig_nicklist_synced(ICB_CHANNEL_REC *channel)
+{
+	ICB_SERVER_REC *server;
+	gint64 elapsed;
+
+	if (!IS_ICB_CHANNEL(channel))
+		return;
+
+	server = ICB_SERVER(channel->server);
+	icb_connect_phase(server, ICB_CONNECT_SYNCED);
+	if (server->group != channel || server->group_switched == 0)
+		return;
+
+	elapsed = g_get_monotonic_time() - server->group_switched;
+	if (!server->group_shown) {
+		server->group_shows++;
+		server->group_show_time += elapsed;
+	}
+	server->group_syncs++;
+	server->group_sync_time += elapsed;
+	server->group_switched = 0;
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	if (!IS_ICB_SERVER(server))
+		return;
+
+	g_slist_foreach(server->group_cache, (GFunc) group_cache_free, NULL);
+	g_slist_free(server->group_cache);
+	server->group_cache = NULL;
+}
+
+static void read_settings(void)
+{
+	group_cache_size = settings_get_int("icb_group_cache_size");
+	group_cache_time = settings_get_time("icb_group_cache_time") / 1000;
+}
+
 void icb_channels_init(void)
 {
+	settings_add_int("icb", "icb_group_cache_size", 5);
+	settings_add_time("icb", "icb_group_cache_time", "1h");
+	read_settings();
+
+	signal_add("setup changed", (SIGNAL_FUNC) read_settings);
         signal_add_first("event connected", (SIGNAL_FUNC) sig_connected);
+	signal_add("icb nicklist synced", (SIGNAL_FUNC) sig_nicklist_synced);
+	signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
 }
 
 void icb_channels_deinit(void)
 {
+	signal_remove("setup changed", (SIGNAL_FUNC) read_settings);
         signal_remove("event connected", (SIGNAL_FUNC) sig_connected);
+	signal_remove("icb nicklist synced", (SIGNAL_FUNC) sig_nicklist_synced);
+	signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
 }
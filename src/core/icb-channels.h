@@ -14,8 +14,29 @@
 #define STRUCT_SERVER_REC ICB_SERVER_REC
 struct _ICB_CHANNEL_REC {
 #include "channel-rec.h"
+
+	GHashTable *sync_nicks;	/* members seen by the running /who sync */
+	GStringChunk *sync_pool; /* the nicks in sync_nicks */
+	int sync_live;		/* of them already in the nicklist */
+	int sync_ops;		/* of those, ones with a changed op status */
+	GPtrArray *sync_pending; /* listed nicks still to be added */
+	int sync_tag;		/* idle source adding them */
+	int sync_added, sync_removed;
+	time_t sync_time;	/* when the last /who sync ended, or 0 */
 };
 
+/* State of a recently left group, so that coming back can show it at
+   once while a /who sync confirms it */
+typedef struct {
+	char *name;
+	char *topic, *topic_by;
+	time_t topic_time;
+
+	GStringChunk *pool;
+	GPtrArray *nicks;	/* flag ('*' or ' ') + nick, in pool */
+	time_t synced;
+} ICB_GROUP_CACHE_REC;
+
 /* Create new ICB channel record */
 ICB_CHANNEL_REC *icb_channel_create(ICB_SERVER_REC *server, const char *name,
 				    const char *visible_name, int automatic);
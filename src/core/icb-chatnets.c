@@ -0,0 +1,85 @@
+/*
+ icb-chatnets.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "signals.h"
+#include "lib-config/iconfig.h"
+#include "settings.h"
+
+#include "icb-chatnets.h"
+#include "icb-servers.h"
+
+static void sig_chatnet_read(ICB_CHATNET_REC *rec, CONFIG_NODE *node)
+{
+	if (!IS_ICB_CHATNET(rec))
+		return;
+
+	rec->tcp_nodelay = config_node_get_bool(node, "tcp_nodelay", TRUE);
+	rec->tcp_cork = config_node_get_bool(node, "tcp_cork", FALSE);
+	rec->fast_connect = config_node_get_bool(node, "fast_connect", FALSE);
+	rec->max_cmds_at_once = config_node_get_int(node, "cmdmax", 0);
+	rec->cmd_queue_speed = config_node_get_int(node, "cmdspeed", 0);
+}
+
+static void sig_chatnet_saved(ICB_CHATNET_REC *rec, CONFIG_NODE *node)
+{
+	if (!IS_ICB_CHATNET(rec))
+		return;
+
+	if (!rec->tcp_nodelay)
+		iconfig_node_set_bool(node, "tcp_nodelay", FALSE);
+	if (rec->tcp_cork)
+		iconfig_node_set_bool(node, "tcp_cork", TRUE);
+	if (rec->fast_connect)
+		iconfig_node_set_bool(node, "fast_connect", TRUE);
+	if (rec->max_cmds_at_once > 0)
+		iconfig_node_set_int(node, "cmdmax", rec->max_cmds_at_once);
+	if (rec->cmd_queue_speed > 0)
+		iconfig_node_set_int(node, "cmdspeed", rec->cmd_queue_speed);
+}
+
+static void sig_server_setup_fill_chatnet(ICB_SERVER_CONNECT_REC *conn,
+					  ICB_CHATNET_REC *icbnet)
+{
+	if (!IS_ICB_SERVER_CONNECT(conn))
+		return;
+	g_return_if_fail(IS_ICB_CHATNET(icbnet));
+
+	conn->tcp_nodelay = icbnet->tcp_nodelay;
+	conn->tcp_cork = icbnet->tcp_cork;
+	conn->fast_connect = icbnet->fast_connect;
+
+	if (icbnet->max_cmds_at_once > 0)
+		conn->max_cmds_at_once = icbnet->max_cmds_at_once;
+	if (icbnet->cmd_queue_speed > 0)
+		conn->cmd_queue_speed = icbnet->cmd_queue_speed;
+}
+
+void icb_chatnets_init(void)
+{
+	signal_add("chatnet read", (SIGNAL_FUNC) sig_chatnet_read);
+	signal_add("chatnet saved", (SIGNAL_FUNC) sig_chatnet_saved);
+	signal_add("server setup fill chatnet", (SIGNAL_FUNC) sig_server_setup_fill_chatnet);
+}
+
+void icb_chatnets_deinit(void)
+{
+	signal_remove("chatnet read", (SIGNAL_FUNC) sig_chatnet_read);
+	signal_remove("chatnet saved", (SIGNAL_FUNC) sig_chatnet_saved);
+	signal_remove("server setup fill chatnet", (SIGNAL_FUNC) sig_server_setup_fill_chatnet);
+}
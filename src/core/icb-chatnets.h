@@ -0,0 +1,30 @@
+#ifndef __ICB_CHATNETS_H
+#define __ICB_CHATNETS_H
+
+#include "chatnets.h"
+
+/* returns ICB_CHATNET_REC if it's ICB network, NULL if it isn't */
+#define ICB_CHATNET(chatnet) \
+	PROTO_CHECK_CAST(CHATNET(chatnet), ICB_CHATNET_REC, chat_type, "ICB")
+
+#define IS_ICB_CHATNET(chatnet) \
+	(ICB_CHATNET(chatnet) ? TRUE : FALSE)
+
+#define icb_chatnet_find(name) \
+	ICB_CHATNET(chatnet_find(name))
+
+struct _ICB_CHATNET_REC {
+#include "chatnet-rec.h"
+
+	unsigned int tcp_nodelay:1;	/* disable Nagle's algorithm */
+	unsigned int tcp_cork:1;	/* cork the socket while flushing */
+	unsigned int fast_connect:1;	/* log in without waiting for the server */
+
+	int max_cmds_at_once;
+	int cmd_queue_speed;
+};
+
+void icb_chatnets_init(void);
+void icb_chatnets_deinit(void);
+
+#endif
@@ -90,6 +90,14 @@ static void cmd_group(const char *data, ICB_SERVER_REC *server)
         icb_change_channel(server, data, FALSE);
 }
 
+/* SYNTAX: ICB <subcommand> */
+static void cmd_icb(const char *data, ICB_SERVER_REC *server, void *item)
+{
+	CMD_ICB_SERVER(server);
+
+	command_runsub("icb", data, server, item);
+}
+
 static void cmd_beep(const char *data, ICB_SERVER_REC *server)
 {
 	CMD_ICB_SERVER(server);
@@ -116,6 +124,7 @@ void icb_commands_init(void)
         command_bind_icb("kick", NULL, (SIGNAL_FUNC) cmd_boot);
         command_bind_icb("g", NULL, (SIGNAL_FUNC) cmd_group);
         command_bind_icb("beep", NULL, (SIGNAL_FUNC) cmd_beep);
+        command_bind_icb("icb", NULL, (SIGNAL_FUNC) cmd_icb);
 
 	command_set_options("connect", "+icbnet");
 }
@@ -134,4 +143,5 @@ void icb_commands_deinit(void)
         command_unbind("kick", (SIGNAL_FUNC) cmd_boot);
         command_unbind("g", (SIGNAL_FUNC) cmd_group);
         command_unbind("beep", (SIGNAL_FUNC) cmd_beep);
+        command_unbind("icb", (SIGNAL_FUNC) cmd_icb);
 }
@@ -26,11 +26,19 @@
 #include "servers-setup.h"
 #include "channels-setup.h"
 
+#include "icb-chatnets.h"
 #include "icb-commands.h"
 #include "icb-servers.h"
 #include "icb-channels.h"
+#include "icb-nicklist.h"
 #include "icb-queries.h"
 #include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-capture.h"
+#include "icb-directory.h"
+#include "icb-request.h"
+#include "icb-lag.h"
+#include "icb-metrics.h"
 
 void icb_session_init(void);
 void icb_session_deinit(void);
@@ -38,48 +46,13 @@ void icb_session_deinit(void);
 void icb_servers_reconnect_init(void);
 void icb_servers_reconnect_deinit(void);
 
-char **icb_split(const char *data, int count)
-{
-        const char *start;
-	char **ret;
-        int pos;
-
-	ret = g_new(char *, count+1);
-	memset(ret, 0, sizeof(char *) * (count+1));
-
-	if (count == 1) {
-                /* only one parameter - return it */
-		ret[0] = g_strdup(data);
-                return ret;
-	}
-
-        start = data; pos = 0;
-	while (*data != '\0') {
-		if (*data == '\001') {
-			ret[pos++] = g_strndup(start, data-start);
-                        start = data+1;
-			if (pos == count-1)
-                                break;
-		}
-                data++;
-	}
-
-	ret[pos] = g_strdup(start);
-	return ret;
-}
-
-void icb_split_free(char **args)
-{
-	char **pos;
-
-	for (pos = args; *pos != NULL; pos++)
-		g_free(*pos);
-        g_free(args);
-}
-
 static CHATNET_REC *create_chatnet(void)
 {
-        return g_malloc0(sizeof(CHATNET_REC));
+	ICB_CHATNET_REC *rec;
+
+	rec = g_new0(ICB_CHATNET_REC, 1);
+	rec->tcp_nodelay = TRUE;
+        return (CHATNET_REC *) rec;
 }
 
 static SERVER_SETUP_REC *create_server_setup(void)
@@ -94,7 +67,11 @@ static CHANNEL_SETUP_REC *create_channel_setup(void)
 
 static SERVER_CONNECT_REC *create_server_connect(void)
 {
-        return g_malloc0(sizeof(SERVER_CONNECT_REC));
+	ICB_SERVER_CONNECT_REC *conn;
+
+	conn = g_new0(ICB_SERVER_CONNECT_REC, 1);
+	conn->tcp_nodelay = TRUE;
+        return (SERVER_CONNECT_REC *) conn;
 }
 
 static void destroy_server_connect(SERVER_CONNECT_REC *conn)
@@ -134,10 +111,18 @@ void icb_core_init(void)
 	chat_protocol_register(rec);
         g_free(rec);
 
+	icb_chatnets_init();
 	icb_servers_init();
 	icb_servers_reconnect_init();
         icb_channels_init();
+	icb_nicklist_init();
 	icb_protocol_init();
+	icb_sendq_init();
+	icb_capture_init();
+	icb_directory_init();
+	icb_request_init();
+	icb_lag_init();
+	icb_metrics_init();
 	icb_commands_init();
         icb_session_init();
 
@@ -146,10 +131,18 @@ void icb_core_init(void)
 
 void icb_core_deinit(void)
 {
+	icb_chatnets_deinit();
 	icb_servers_deinit();
 	icb_servers_reconnect_deinit();
         icb_channels_deinit();
+	icb_nicklist_deinit();
 	icb_protocol_deinit();
+	icb_sendq_deinit();
+	icb_capture_deinit();
+	icb_directory_deinit();
+	icb_request_deinit();
+	icb_lag_deinit();
+	icb_metrics_deinit();
         icb_commands_deinit();
         icb_session_deinit();
 
@@ -0,0 +1,615 @@
+/*
+ icb-directory.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "signals.h"
+#include "settings.h"
+#include "misc.h"
+
+#include "icb-servers.h"
+#include "icb-channels.h"
+#include "icb-directory.h"
+
+/* rough cost of a hash table entry, for the memory estimate */
+#define HASH_ENTRY_SIZE (3 * sizeof(void *) + sizeof(guint))
+#define HASH_TABLE_SIZE (8 * HASH_ENTRY_SIZE)
+
+#define POOL_CHUNK_SIZE 4096
+
+static void directory_pool_create(ICB_DIRECTORY_REC *dir)
+{
+	dir->pool = g_string_chunk_new(POOL_CHUNK_SIZE);
+	dir->strings = g_hash_table_new(g_str_hash, g_str_equal);
+	dir->pool_bytes = dir->released_bytes = 0;
+}
+
+static void directory_pool_destroy(ICB_DIRECTORY_REC *dir)
+{
+	g_hash_table_destroy(dir->strings);
+	g_string_chunk_free(dir->pool);
+}
+
+static ICB_DIRECTORY_REC *directory_get(ICB_SERVER_REC *server)
+{
+	ICB_DIRECTORY_REC *dir;
+
+	if (server->directory != NULL)
+		return server->directory;
+
+	dir = g_new0(ICB_DIRECTORY_REC, 1);
+	dir->users = g_hash_table_new((GHashFunc) g_istr_hash,
+				      (GEqualFunc) g_istr_equal);
+	dir->groups = g_hash_table_new((GHashFunc) g_istr_hash,
+				       (GEqualFunc) g_istr_equal);
+	directory_pool_create(dir);
+
+	server->directory = dir;
+	return dir;
+}
+
+static const char *directory_intern(ICB_DIRECTORY_REC *dir, const char *str)
+{
+	char *interned;
+
+	if (str == NULL)
+		return NULL;
+
+	interned = g_hash_table_lookup(dir->strings, str);
+	if (interned == NULL) {
+		interned = g_string_chunk_insert(dir->pool, str);
+		g_hash_table_insert(dir->strings, interned, interned);
+		dir->pool_bytes += strlen(str) + 1;
+	}
+	return interned;
+}
+
+/* Replace the string in *field, the old one stays in the pool */
+static void directory_set_str(ICB_DIRECTORY_REC *dir, const char **field,
+			      const char *value)
+{
+	if (*field != NULL && value != NULL && strcmp(*field, value) == 0)
+		return;
+
+	if (*field != NULL)
+		dir->released_bytes += strlen(*field) + 1;
+	*field = directory_intern(dir, value);
+}
+
+static ICB_DIRGROUP_REC *group_get(ICB_DIRECTORY_REC *dir, const char *name)
+{
+	ICB_DIRGROUP_REC *group;
+
+	group = g_hash_table_lookup(dir->groups, name);
+	if (group != NULL)
+		return group;
+
+	group = g_new0(ICB_DIRGROUP_REC, 1);
+	directory_set_str(dir, &group->name, name);
+	group->users = g_hash_table_new((GHashFunc) g_istr_hash,
+					(GEqualFunc) g_istr_equal);
+	g_hash_table_insert(dir->groups, (char *) group->name, group);
+	return group;
+}
+
+static void group_destroy(ICB_DIRECTORY_REC *dir, ICB_DIRGROUP_REC *group)
+{
+	g_hash_table_remove(dir->groups, group->name);
+	g_hash_table_destroy(group->users);
+	directory_set_str(dir, &group->name, NULL);
+	g_free(group);
+}
+
+/* Groups go away with their last user, unless a /who is listing it */
+static void group_check_empty(ICB_DIRECTORY_REC *dir, ICB_DIRGROUP_REC *group)
+{
+	if (group != NULL && group != dir->listing &&
+	    g_hash_table_size(group->users) == 0)
+		group_destroy(dir, group);
+}
+
+static void user_set_group(ICB_DIRECTORY_REC *dir, ICB_USER_REC *user,
+			   ICB_DIRGROUP_REC *group)
+{
+	ICB_DIRGROUP_REC *old;
+
+	old = user->group;
+	if (old == group)
+		return;
+
+	if (old != NULL)
+		g_hash_table_remove(old->users, user->nick);
+	user->group = group;
+	if (group != NULL)
+		g_hash_table_insert(group->users, (char *) user->nick, user);
+	group_check_empty(dir, old);
+}
+
+static ICB_USER_REC *user_get(ICB_DIRECTORY_REC *dir, const char *nick)
+{
+	ICB_USER_REC *user;
+
+	user = g_hash_table_lookup(dir->users, nick);
+	if (user != NULL)
+		return user;
+
+	user = g_new0(ICB_USER_REC, 1);
+	directory_set_str(dir, &user->nick, nick);
+	g_hash_table_insert(dir->users, (char *) user->nick, user);
+	return user;
+}
+
+static void user_destroy(ICB_DIRECTORY_REC *dir, ICB_USER_REC *user)
+{
+	user_set_group(dir, user, NULL);
+	g_hash_table_remove(dir->users, user->nick);
+
+	directory_set_str(dir, &user->nick, NULL);
+	directory_set_str(dir, &user->user, NULL);
+	directory_set_str(dir, &user->host, NULL);
+	directory_set_str(dir, &user->status, NULL);
+	g_free(user);
+}
+
+static void user_rename(ICB_DIRECTORY_REC *dir, ICB_USER_REC *user,
+			const char *newnick)
+{
+	ICB_DIRGROUP_REC *group;
+	ICB_USER_REC *old;
+
+	old = g_hash_table_lookup(dir->users, newnick);
+	if (old != NULL && old != user)
+		user_destroy(dir, old);
+
+	/* the nick is the key in both tables */
+	group = user->group;
+	if (group != NULL)
+		g_hash_table_remove(group->users, user->nick);
+	g_hash_table_remove(dir->users, user->nick);
+
+	directory_set_str(dir, &user->nick, newnick);
+
+	g_hash_table_insert(dir->users, (char *) user->nick, user);
+	if (group != NULL)
+		g_hash_table_insert(group->users, (char *) user->nick, user);
+}
+
+static void directory_set_listing(ICB_DIRECTORY_REC *dir,
+				  ICB_DIRGROUP_REC *group)
+{
+	ICB_DIRGROUP_REC *old;
+
+	old = dir->listing;
+	dir->listing = group;
+	group_check_empty(dir, old);
+}
+
+/* Drop the users a full /who didn't list */
+static void directory_prune(ICB_DIRECTORY_REC *dir)
+{
+	GHashTableIter iter;
+	ICB_USER_REC *user;
+	GSList *gone;
+	void *key;
+
+	gone = NULL;
+	g_hash_table_iter_init(&iter, dir->users);
+	while (g_hash_table_iter_next(&iter, &key, (void **) &user)) {
+		if (user->listed != dir->serial)
+			gone = g_slist_prepend(gone, user);
+	}
+
+	while (gone != NULL) {
+		user_destroy(dir, gone->data);
+		gone = g_slist_delete_link(gone, gone);
+	}
+}
+
+/* Move the strings still in use to a new pool and free the old one in
+   one go. The tables are keyed by the strings, so they're rebuilt too. */
+static void directory_compact(ICB_DIRECTORY_REC *dir)
+{
+	GHashTable *users, *groups, *strings;
+	GStringChunk *pool;
+	GHashTableIter iter;
+	ICB_USER_REC *user;
+	ICB_DIRGROUP_REC *group;
+	void *key;
+
+	pool = dir->pool;
+	strings = dir->strings;
+	users = dir->users;
+	groups = dir->groups;
+
+	directory_pool_create(dir);
+	dir->users = g_hash_table_new((GHashFunc) g_istr_hash,
+				      (GEqualFunc) g_istr_equal);
+	dir->groups = g_hash_table_new((GHashFunc) g_istr_hash,
+				       (GEqualFunc) g_istr_equal);
+
+	g_hash_table_iter_init(&iter, groups);
+	while (g_hash_table_iter_next(&iter, &key, (void **) &group)) {
+		group->name = directory_intern(dir, group->name);
+		g_hash_table_remove_all(group->users);
+		g_hash_table_insert(dir->groups, (char *) group->name, group);
+	}
+
+	g_hash_table_iter_init(&iter, users);
+	while (g_hash_table_iter_next(&iter, &key, (void **) &user)) {
+		user->nick = directory_intern(dir, user->nick);
+		user->user = directory_intern(dir, user->user);
+		user->host = directory_intern(dir, user->host);
+		user->status = directory_intern(dir, user->status);
+
+		g_hash_table_insert(dir->users, (char *) user->nick, user);
+		if (user->group != NULL) {
+			g_hash_table_insert(user->group->users,
+					    (char *) user->nick, user);
+		}
+	}
+
+	g_hash_table_destroy(users);
+	g_hash_table_destroy(groups);
+	g_hash_table_destroy(strings);
+	g_string_chunk_free(pool);
+}
+
+static void directory_destroy(ICB_DIRECTORY_REC *dir)
+{
+	GHashTableIter iter;
+	ICB_USER_REC *user;
+	ICB_DIRGROUP_REC *group;
+	void *key;
+
+	g_hash_table_iter_init(&iter, dir->users);
+	while (g_hash_table_iter_next(&iter, &key, (void **) &user))
+		g_free(user);
+	g_hash_table_iter_init(&iter, dir->groups);
+	while (g_hash_table_iter_next(&iter, &key, (void **) &group)) {
+		g_hash_table_destroy(group->users);
+		g_free(group);
+	}
+
+	g_hash_table_destroy(dir->users);
+	g_hash_table_destroy(dir->groups);
+	directory_pool_destroy(dir);
+	g_free(dir);
+}
+
+ICB_USER_REC *icb_directory_find(ICB_SERVER_REC *server, const char *nick)
+{
+	g_return_val_if_fail(nick != NULL, NULL);
+
+	if (server->directory == NULL)
+		return NULL;
+	return g_hash_table_lookup(server->directory->users, nick);
+}
+
+ICB_DIRGROUP_REC *icb_directory_find_group(ICB_SERVER_REC *server,
+					   const char *name)
+{
+	g_return_val_if_fail(name != NULL, NULL);
+
+	if (server->directory == NULL)
+		return NULL;
+	return g_hash_table_lookup(server->directory->groups, name);
+}
+
+void icb_directory_listing_end(ICB_SERVER_REC *server)
+{
+	ICB_DIRECTORY_REC *dir;
+
+	dir = server->directory;
+	if (dir == NULL || !dir->in_listing)
+		return;
+
+	/* not a full listing, so nobody is pruned */
+	directory_set_listing(dir, NULL);
+	dir->in_listing = FALSE;
+}
+
+int icb_directory_fresh(ICB_SERVER_REC *server, ICB_USER_REC *user)
+{
+	ICB_DIRECTORY_REC *dir;
+
+	if (user->group == NULL)
+		return FALSE;
+	if (server->group != NULL &&
+	    g_ascii_strcasecmp(user->group->name, server->group->name) == 0)
+		return TRUE;
+
+	dir = server->directory;
+	return user->listed == dir->serial &&
+		time(NULL) - dir->serial_time <=
+		settings_get_time("icb_directory_max_age") / 1000;
+}
+
+size_t icb_directory_size(ICB_SERVER_REC *server)
+{
+	ICB_DIRECTORY_REC *dir;
+	size_t size;
+
+	dir = server->directory;
+	if (dir == NULL)
+		return 0;
+
+	size = sizeof(ICB_DIRECTORY_REC) + 3 * HASH_TABLE_SIZE +
+		dir->pool_bytes;
+	size += g_hash_table_size(dir->strings) * HASH_ENTRY_SIZE;
+	size += g_hash_table_size(dir->users) *
+		(sizeof(ICB_USER_REC) + 2 * HASH_ENTRY_SIZE);
+	size += g_hash_table_size(dir->groups) *
+		(sizeof(ICB_DIRGROUP_REC) + HASH_TABLE_SIZE + HASH_ENTRY_SIZE);
+	return size;
+}
+
+GList *icb_directory_complete(ICB_SERVER_REC *server, const char *prefix,
+			      GList *list, int max)
+{
+	GHashTableIter iter;
+	ICB_USER_REC *user;
+	void *key;
+	size_t len;
+
+	if (server->directory == NULL)
+		return list;
+
+	len = strlen(prefix);
+	g_hash_table_iter_init(&iter, server->directory->users);
+	while (max > 0 &&
+	       g_hash_table_iter_next(&iter, &key, (void **) &user)) {
+		if (g_ascii_strncasecmp(user->nick, prefix, len) == 0) {
+			list = g_list_append(list, g_strdup(user->nick));
+			max--;
+		}
+	}
+	return list;
+}
+
+/* "<nick> (<user>@<host>) ..." */
+static void parse_userhost(const char *text, char *user, char *host,
+			   size_t size)
+{
+	const char *start, *at, *end;
+	size_t len;
+
+	*user = *host = '\0';
+	start = strchr(text, '(');
+	if (start == NULL)
+		return;
+	start++;
+	at = strchr(start, '@');
+	end = strchr(start, ')');
+	if (at == NULL || end == NULL || at > end)
+		return;
+
+	len = MIN((size_t) (at - start), size-1);
+	memcpy(user, start, len);
+	user[len] = '\0';
+	at++;
+	len = MIN((size_t) (end - at), size-1);
+	memcpy(host, at, len);
+	host[len] = '\0';
+}
+
+/* A user appeared in our group */
+static ICB_USER_REC *directory_arrive(ICB_SERVER_REC *server,
+				      const char *text)
+{
+	ICB_DIRECTORY_REC *dir;
+	ICB_USER_REC *user;
+	char nick[ICB_WORD_BUFSIZE];
+	char username[ICB_WORD_BUFSIZE], host[ICB_WORD_BUFSIZE];
+
+	dir = directory_get(server);
+	icb_get_word(text, nick, sizeof(nick));
+	parse_userhost(text, username, host, sizeof(username));
+
+	user = user_get(dir, nick);
+	if (*username != '\0') {
+		directory_set_str(dir, &user->user, username);
+		directory_set_str(dir, &user->host, host);
+	}
+	if (server->group != NULL)
+		user_set_group(dir, user, group_get(dir, server->group->name));
+	return user;
+}
+
+static void directory_leave(ICB_SERVER_REC *server, const char *text,
+			    int signoff)
+{
+	ICB_USER_REC *user;
+	char nick[ICB_WORD_BUFSIZE];
+
+	if (server->directory == NULL)
+		return;
+
+	icb_get_word(text, nick, sizeof(nick));
+	user = g_hash_table_lookup(server->directory->users, nick);
+	if (user == NULL)
+		return;
+
+	/* departed users are still on the server, somewhere */
+	if (signoff)
+		user_destroy(server->directory, user);
+	else
+		user_set_group(server->directory, user, NULL);
+}
+
+static void cmdout_co(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_DIRECTORY_REC *dir;
+	char group[ICB_WORD_BUFSIZE];
+	const char *line;
+
+	static const char match_group[] = "Group: ";
+	static const char match_total[] = "Total: ";
+
+	line = packet->fields[1];
+	if (line == NULL)
+		return;
+
+	if (strncmp(line, match_group, sizeof(match_group)-1) == 0) {
+		dir = directory_get(server);
+		if (!dir->in_listing) {
+			dir->in_listing = TRUE;
+			dir->serial++;
+			dir->serial_time = time(NULL);
+		}
+
+		icb_get_word(line + sizeof(match_group)-1,
+			     group, sizeof(group));
+		directory_set_listing(dir, group_get(dir, group));
+	} else if (strncmp(line, match_total, sizeof(match_total)-1) == 0 &&
+		   server->directory != NULL) {
+		dir = server->directory;
+		directory_set_listing(dir, NULL);
+		if (dir->in_listing)
+			directory_prune(dir);
+		dir->in_listing = FALSE;
+
+		/* over half of the pool may be unused */
+		if (dir->released_bytes > dir->pool_bytes / 2 &&
+		    dir->pool_bytes > POOL_CHUNK_SIZE)
+			directory_compact(dir);
+	}
+}
+
+static void cmdout_wl(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_DIRECTORY_REC *dir;
+	ICB_USER_REC *user;
+	ICB_WHO_REC who;
+	time_t now;
+
+	if (!icb_who_parse(&who, packet))
+		return;
+
+	dir = directory_get(server);
+	user = user_get(dir, who.nick);
+	if (dir->listing != NULL)
+		user_set_group(dir, user, dir->listing);
+
+	directory_set_str(dir, &user->user, who.user);
+	directory_set_str(dir, &user->host, who.host);
+	directory_set_str(dir, &user->status, who.status);
+	user->mod = who.mod == '*' || who.mod == 'm';
+
+	now = time(NULL);
+	user->idle_since = now - strtol(who.idle, NULL, 10);
+	user->login = strtol(who.login, NULL, 10);
+	user->listed = dir->serial;
+}
+
+/* Whoever sends a message isn't idle */
+static void event_message(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_USER_REC *user;
+
+	if (server->directory == NULL || packet->fields[0] == NULL)
+		return;
+
+	user = g_hash_table_lookup(server->directory->users,
+				   packet->fields[0]);
+	if (user != NULL)
+		user->idle_since = time(NULL);
+}
+
+static void status_signon(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_USER_REC *user;
+
+	if (packet->fields[1] == NULL)
+		return;
+
+	user = directory_arrive(server, packet->fields[1]);
+	user->login = user->idle_since = time(NULL);
+}
+
+static void status_arrive(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	if (packet->fields[1] != NULL)
+		directory_arrive(server, packet->fields[1]);
+}
+
+static void status_signoff(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	if (packet->fields[1] != NULL)
+		directory_leave(server, packet->fields[1], TRUE);
+}
+
+static void status_depart(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	if (packet->fields[1] != NULL)
+		directory_leave(server, packet->fields[1], FALSE);
+}
+
+/* "<oldnick> changed nickname to <newnick>" */
+static void status_name(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_USER_REC *user;
+	char oldnick[ICB_WORD_BUFSIZE];
+	const char *newnick;
+
+	if (packet->fields[1] == NULL || server->directory == NULL)
+		return;
+
+	icb_get_word(packet->fields[1], oldnick, sizeof(oldnick));
+	newnick = strrchr(packet->fields[1], ' ');
+	user = g_hash_table_lookup(server->directory->users, oldnick);
+	if (newnick != NULL && user != NULL)
+		user_rename(server->directory, user, newnick+1);
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	if (!IS_ICB_SERVER(server) || server->directory == NULL)
+		return;
+
+	directory_destroy(server->directory);
+	server->directory = NULL;
+}
+
+void icb_directory_init(void)
+{
+	settings_add_time("icb", "icb_directory_max_age", "5min");
+
+	signal_add("icb event open", (SIGNAL_FUNC) event_message);
+	signal_add("icb event personal", (SIGNAL_FUNC) event_message);
+	signal_add("icb cmdout co", (SIGNAL_FUNC) cmdout_co);
+	signal_add("icb cmdout wl", (SIGNAL_FUNC) cmdout_wl);
+	signal_add("icb status sign-on", (SIGNAL_FUNC) status_signon);
+	signal_add("icb status arrive", (SIGNAL_FUNC) status_arrive);
+	signal_add("icb status sign-off", (SIGNAL_FUNC) status_signoff);
+	signal_add("icb status depart", (SIGNAL_FUNC) status_depart);
+	signal_add("icb status name", (SIGNAL_FUNC) status_name);
+	signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
+
+void icb_directory_deinit(void)
+{
+	signal_remove("icb event open", (SIGNAL_FUNC) event_message);
+	signal_remove("icb event personal", (SIGNAL_FUNC) event_message);
+	signal_remove("icb cmdout co", (SIGNAL_FUNC) cmdout_co);
+	signal_remove("icb cmdout wl", (SIGNAL_FUNC) cmdout_wl);
+	signal_remove("icb status sign-on", (SIGNAL_FUNC) status_signon);
+	signal_remove("icb status arrive", (SIGNAL_FUNC) status_arrive);
+	signal_remove("icb status sign-off", (SIGNAL_FUNC) status_signoff);
+	signal_remove("icb status depart", (SIGNAL_FUNC) status_depart);
+	signal_remove("icb status name", (SIGNAL_FUNC) status_name);
+	signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
@@ -0,0 +1,73 @@
+#ifndef __ICB_DIRECTORY_H
+#define __ICB_DIRECTORY_H
+
+/*
+ * Every user on the server we know about, keyed by nick. Filled from
+ * /who listings and kept current from the sign-on, sign-off, arrive,
+ * depart and name status messages. Users in other groups only come and
+ * go with a full /who, whose Total: line drops the ones it didn't list.
+ *
+ * The strings are interned in a pool per server, so a host or status
+ * shared by many users is stored once. Replaced strings stay in the pool
+ * until it is rebuilt after a full /who.
+ */
+
+typedef struct _ICB_DIRGROUP_REC ICB_DIRGROUP_REC;
+
+typedef struct {
+	const char *nick;
+	ICB_DIRGROUP_REC *group; /* NULL if not known */
+
+	const char *user, *host;
+	const char *status;	/* registration status */
+	int mod;
+
+	time_t idle_since;	/* 0 if not known */
+	time_t login;		/* 0 if not known */
+
+	unsigned int listed;	/* serial of the last /who listing it */
+} ICB_USER_REC;
+
+struct _ICB_DIRGROUP_REC {
+	const char *name;
+	GHashTable *users;	/* nick -> ICB_USER_REC */
+};
+
+struct _ICB_DIRECTORY_REC {
+	GHashTable *users;	/* nick -> ICB_USER_REC */
+	GHashTable *groups;	/* name -> ICB_DIRGROUP_REC */
+
+	GStringChunk *pool;	/* interned strings */
+	GHashTable *strings;	/* string -> itself in pool */
+	size_t pool_bytes;	/* bytes in pool */
+	size_t released_bytes;	/* bytes replaced, maybe still used */
+
+	ICB_DIRGROUP_REC *listing; /* group of the /who lines being read */
+	unsigned int serial;	/* current /who listing */
+	time_t serial_time;	/* when it started */
+	int in_listing;
+};
+
+ICB_USER_REC *icb_directory_find(ICB_SERVER_REC *server, const char *nick);
+ICB_DIRGROUP_REC *icb_directory_find_group(ICB_SERVER_REC *server,
+					   const char *name);
+
+/* TRUE if the group of user is known well enough to answer for the
+   server: user is in our group, or was in the last /who listing and
+   that was at most icb_directory_max_age ago */
+int icb_directory_fresh(ICB_SERVER_REC *server, ICB_USER_REC *user);
+
+/* A /who of one group ended, it has no Total: line to say so */
+void icb_directory_listing_end(ICB_SERVER_REC *server);
+
+/* Estimated memory used by the directory of server */
+size_t icb_directory_size(ICB_SERVER_REC *server);
+
+/* Add nicks starting with prefix to list, at most max of them */
+GList *icb_directory_complete(ICB_SERVER_REC *server, const char *prefix,
+			      GList *list, int max);
+
+void icb_directory_init(void);
+void icb_directory_deinit(void);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ icb-histogram.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+
+#include "icb-histogram.h"
+
+static int bucket_index(guint64 value)
+{
+	int shift;
+
+	if (value > ICB_HISTOGRAM_MAX)
+		value = ICB_HISTOGRAM_MAX;
+	if (value < 2 * ICB_HISTOGRAM_SUB)
+		return (int) value;
+
+	/* keep only the top ICB_HISTOGRAM_SUB_BITS+1 bits */
+	shift = g_bit_storage((gulong) value) - (ICB_HISTOGRAM_SUB_BITS + 1);
+	return (shift << ICB_HISTOGRAM_SUB_BITS) + (int) (value >> shift);
+}
+
+guint64 icb_histogram_bucket_low(int index)
+{
+	int shift;
+
+	if (index < 2 * ICB_HISTOGRAM_SUB)
+		return index;
+
+	shift = (index >> ICB_HISTOGRAM_SUB_BITS) - 1;
+	return (guint64) (index - (shift << ICB_HISTOGRAM_SUB_BITS)) << shift;
+}
+
+void icb_histogram_add(ICB_HISTOGRAM_REC *hist, guint64 value)
+{
+	if (hist->count == 0 || value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+
+	hist->count++;
+	hist->sum += value;
+	hist->buckets[bucket_index(value)]++;
+}
+
+void icb_histogram_reset(ICB_HISTOGRAM_REC *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+guint64 icb_histogram_percentile(const ICB_HISTOGRAM_REC *hist, double pct)
+{
+	unsigned long wanted, seen;
+	guint64 value;
+	int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	wanted = (unsigned long) (hist->count * pct / 100.0 + 0.5);
+	if (wanted == 0)
+		wanted = 1;
+
+	seen = 0;
+	for (i = 0; i < ICB_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= wanted)
+			break;
+	}
+
+	/* the highest value of the bucket, but never above the max seen */
+	value = i + 1 < ICB_HISTOGRAM_BUCKETS ?
+		icb_histogram_bucket_low(i + 1) - 1 : hist->max;
+	return value < hist->max ? value : hist->max;
+}
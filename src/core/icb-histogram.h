@@ -0,0 +1,35 @@
+#ifndef __ICB_HISTOGRAM_H
+#define __ICB_HISTOGRAM_H
+
+/*
+ * Log-linear histogram of non-negative values, in the style of HDR
+ * histograms: values below 2 * ICB_HISTOGRAM_SUB are counted exactly,
+ * above that every power of two is split into ICB_HISTOGRAM_SUB buckets,
+ * so a bucket is never wider than 1/16 of the values in it. Values over
+ * ICB_HISTOGRAM_MAX are counted in the last bucket.
+ */
+#define ICB_HISTOGRAM_SUB_BITS 4
+#define ICB_HISTOGRAM_SUB (1 << ICB_HISTOGRAM_SUB_BITS)
+#define ICB_HISTOGRAM_MAX_BITS 32
+#define ICB_HISTOGRAM_MAX (((guint64) 1 << ICB_HISTOGRAM_MAX_BITS) - 1)
+#define ICB_HISTOGRAM_BUCKETS \
+	((ICB_HISTOGRAM_MAX_BITS - ICB_HISTOGRAM_SUB_BITS + 1) * \
+	 ICB_HISTOGRAM_SUB)
+
+struct _ICB_HISTOGRAM_REC {
+	unsigned long count;
+	guint64 sum, min, max;
+
+	unsigned int buckets[ICB_HISTOGRAM_BUCKETS];
+};
+
+void icb_histogram_add(ICB_HISTOGRAM_REC *hist, guint64 value);
+void icb_histogram_reset(ICB_HISTOGRAM_REC *hist);
+
+/* Value below which pct percent of the values are, 0 if there are none */
+guint64 icb_histogram_percentile(const ICB_HISTOGRAM_REC *hist, double pct);
+
+/* Bucket index covers the values from low(index) to low(index+1)-1 */
+guint64 icb_histogram_bucket_low(int index);
+
+#endif
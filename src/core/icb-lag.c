@@ -0,0 +1,158 @@
+/*
+ icb-lag.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "signals.h"
+#include "settings.h"
+
+#include "icb-servers.h"
+#include "icb-protocol.h"
+#include "icb-histogram.h"
+#include "icb-lag.h"
+
+static int timeout_tag;
+static int lag_check_time, lag_max_before_disconnect, lag_idle_check;
+
+static void lag_send(ICB_SERVER_REC *server)
+{
+	gint64 now;
+
+	g_free(server->lag_id);
+	server->lag_id = g_strdup_printf("irssi-lag-%u", ++server->lag_serial);
+
+	server->lag_ping_sent = g_get_monotonic_time();
+	now = g_get_real_time();
+	server->lag_sent.tv_sec = now / G_USEC_PER_SEC;
+	server->lag_sent.tv_usec = now % G_USEC_PER_SEC;
+	server->lag_last_check = time(NULL);
+
+	icb_ping(server, server->lag_id);
+}
+
+static void event_pong(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	gint64 rtt;
+
+	if (server->lag_id == NULL ||
+	    strcmp(packet->fields[0], server->lag_id) != 0)
+		return;
+
+	rtt = g_get_monotonic_time() - server->lag_ping_sent;
+	g_free_and_null(server->lag_id);
+
+	if (server->lag_histogram == NULL)
+		server->lag_histogram = g_new0(ICB_HISTOGRAM_REC, 1);
+	icb_histogram_add(server->lag_histogram, rtt);
+
+	memset(&server->lag_sent, 0, sizeof(server->lag_sent));
+	server->lag = (int) (rtt / 1000);
+	signal_emit("server lag", 1, server);
+	signal_stop();
+}
+
+/* No pong in time, reconnect - to the next server if it's a chatnet */
+static void lag_disconnect(ICB_SERVER_REC *server, gint64 now)
+{
+	server->connrec->dead_peers++;
+	server->connrec->dead_peer_time += now - server->last_read;
+
+	signal_emit("server lag disconnect", 1, server);
+	server->connection_lost = TRUE;
+	server_disconnect(SERVER(server));
+}
+
+static int lag_idle(ICB_SERVER_REC *server, gint64 now)
+{
+	return lag_idle_check > 0 &&
+		now - server->last_read >= (gint64) lag_idle_check * 1000000;
+}
+
+static int sig_check_lag(void)
+{
+	ICB_SERVER_REC *server;
+	GSList *tmp, *next;
+	gint64 now;
+
+	if (lag_check_time <= 0 && lag_idle_check <= 0)
+		return 1;
+
+	now = g_get_monotonic_time();
+	for (tmp = servers; tmp != NULL; tmp = next) {
+		next = tmp->next;
+
+		server = ICB_SERVER(tmp->data);
+		if (server == NULL || !server->connected)
+			continue;
+
+		if (server->lag_id != NULL) {
+			if (lag_max_before_disconnect > 0 &&
+			    now - server->lag_ping_sent >=
+			    (gint64) lag_max_before_disconnect * 1000000)
+				lag_disconnect(server, now);
+			continue;
+		}
+
+		/* also check early when nothing has been heard for a while,
+		   so a dead connection is noticed in seconds */
+		if ((lag_check_time > 0 &&
+		     time(NULL) - server->lag_last_check >= lag_check_time) ||
+		    lag_idle(server, now))
+			lag_send(server);
+	}
+	return 1;
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	if (!IS_ICB_SERVER(server))
+		return;
+
+	g_free_and_null(server->lag_id);
+	g_free_and_null(server->lag_histogram);
+}
+
+static void read_settings(void)
+{
+	lag_check_time = settings_get_time("icb_lag_check_time") / 1000;
+	lag_max_before_disconnect =
+		settings_get_time("icb_lag_max_before_disconnect") / 1000;
+	lag_idle_check = settings_get_time("icb_lag_idle_check") / 1000;
+}
+
+void icb_lag_init(void)
+{
+	settings_add_time("icb", "icb_lag_check_time", "1min");
+	settings_add_time("icb", "icb_lag_max_before_disconnect", "20s");
+	settings_add_time("icb", "icb_lag_idle_check", "15s");
+
+	read_settings();
+	timeout_tag = g_timeout_add(1000, (GSourceFunc) sig_check_lag, NULL);
+
+	signal_add("setup changed", (SIGNAL_FUNC) read_settings);
+	signal_add_first("icb event pong", (SIGNAL_FUNC) event_pong);
+	signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
+
+void icb_lag_deinit(void)
+{
+	g_source_remove(timeout_tag);
+
+	signal_remove("setup changed", (SIGNAL_FUNC) read_settings);
+	signal_remove("icb event pong", (SIGNAL_FUNC) event_pong);
+	signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
@@ -0,0 +1,20 @@
+#ifndef __ICB_LAG_H
+#define __ICB_LAG_H
+
+/*
+ * Lag meter. Every icb_lag_check_time a ping with its own id is sent to
+ * each connected server, the time until its pong is the lag. It's kept
+ * in the server's lag fields like for IRC, so the lag statusbar item and
+ * the "server lag" signal work the same, and collected into a histogram
+ * per server.
+ *
+ * When nothing has been read for icb_lag_idle_check the ping is sent
+ * early, and if its pong doesn't come in icb_lag_max_before_disconnect
+ * the connection is dropped as lost, so irssi reconnects to the next
+ * server of the chatnet.
+ */
+
+void icb_lag_init(void);
+void icb_lag_deinit(void);
+
+#endif
@@ -0,0 +1,664 @@
+/*
+ icb-metrics.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+
+#include "module.h"
+#include "signals.h"
+#include "settings.h"
+#include "misc.h"
+
+#include "icb-servers.h"
+#include "icb-channels.h"
+#include "icb-directory.h"
+#include "icb-histogram.h"
+#include "icb-stats.h"
+#include "icb-metrics.h"
+
+/* usecs to seconds */
+#define USECS 0.000001
+
+typedef struct {
+	GIOChannel *handle;
+	int tag;
+
+	char *data;
+	int len, pos;
+} METRICS_CLIENT_REC;
+
+static char *listen_path;	/* converted path of the open socket */
+static char *failed_path;	/* path that couldn't be opened, warned once */
+static GIOChannel *listen_handle;
+static int listen_tag;
+static GSList *clients;
+
+static const char *phase_names[ICB_CONNECT_PHASES] = {
+	"tcp", "protocol", "login", "synced"
+};
+
+static const char *lane_names[ICB_SENDQ_LANES] = {
+	"control", "command", "bulk"
+};
+
+static void append_value(GString *str, double value)
+{
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append(str, g_ascii_formatd(buf, sizeof(buf), "%.12g",
+					     value));
+}
+
+/* Append a quoted label value, escaped as the text format wants */
+static void append_quoted(GString *str, const char *value)
+{
+	g_string_append_c(str, '"');
+	for (; *value != '\0'; value++) {
+		if (*value == '\\' || *value == '"')
+			g_string_append_c(str, '\\');
+		if (*value == '\n')
+			g_string_append(str, "\\n");
+		else
+			g_string_append_c(str, *value);
+	}
+	g_string_append_c(str, '"');
+}
+
+static void append_label(GString *str, const char *name, const char *value)
+{
+	g_string_append_printf(str, ",%s=", name);
+	append_quoted(str, value);
+}
+
+static void append_family(GString *str, const char *name, const char *type,
+			  const char *help)
+{
+	g_string_append_printf(str, "# HELP %s %s\n# TYPE %s %s\n",
+			       name, help, name, type);
+}
+
+/* name{server="tag"<extra> */
+static void append_series(GString *str, const char *name, const char *suffix,
+			  ICB_SERVER_REC *server)
+{
+	g_string_append_printf(str, "%s%s{server=", name, suffix);
+	append_quoted(str, server->tag);
+}
+
+static void append_sample(GString *str, const char *name,
+			  ICB_SERVER_REC *server, double value)
+{
+	append_series(str, name, "", server);
+	g_string_append(str, "} ");
+	append_value(str, value);
+	g_string_append_c(str, '\n');
+}
+
+static void append_type_sample(GString *str, const char *name,
+			       ICB_SERVER_REC *server, int type,
+			       unsigned long value)
+{
+	char type_name[2];
+
+	type_name[0] = 'a' + type;
+	type_name[1] = '\0';
+
+	append_series(str, name, "", server);
+	append_label(str, "type", type_name);
+	g_string_append_printf(str, "} %lu\n", value);
+}
+
+/* The histogram buckets are merged to one per power of two, the same
+   ones every time so they can be compared between scrapes. Values are
+   whole units so "le" is one less than the power. */
+static void append_histogram(GString *str, const char *name,
+			     ICB_SERVER_REC *server, const char *label,
+			     const char *label_value,
+			     const ICB_HISTOGRAM_REC *hist, double scale)
+{
+	unsigned long seen;
+	guint64 bound;
+	int i, bit;
+
+	seen = 0; i = 0;
+	for (bit = 0; bit < ICB_HISTOGRAM_MAX_BITS; bit++) {
+		bound = (guint64) 1 << bit;
+		while (i < ICB_HISTOGRAM_BUCKETS &&
+		       icb_histogram_bucket_low(i) < bound)
+			seen += hist->buckets[i++];
+
+		append_series(str, name, "_bucket", server);
+		if (label != NULL)
+			append_label(str, label, label_value);
+		g_string_append(str, ",le=\"");
+		append_value(str, (bound - 1) * scale);
+		g_string_append_printf(str, "\"} %lu\n", seen);
+	}
+
+	append_series(str, name, "_bucket", server);
+	if (label != NULL)
+		append_label(str, label, label_value);
+	g_string_append_printf(str, ",le=\"+Inf\"} %lu\n", hist->count);
+
+	append_series(str, name, "_sum", server);
+	if (label != NULL)
+		append_label(str, label, label_value);
+	g_string_append(str, "} ");
+	append_value(str, hist->sum * scale);
+	g_string_append_c(str, '\n');
+
+	append_series(str, name, "_count", server);
+	if (label != NULL)
+		append_label(str, label, label_value);
+	g_string_append_printf(str, "} %lu\n", hist->count);
+}
+
+static void append_histograms(GString *str, GSList *list, const char *name,
+			      const char *help, size_t offset, double scale)
+{
+	GSList *tmp;
+
+	append_family(str, name, "histogram", help);
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_histogram(str, name, server, NULL, NULL,
+				 G_STRUCT_MEMBER_P(server->stats, offset),
+				 scale);
+	}
+}
+
+static void append_packets(GString *str, GSList *list, const char *name,
+			   const char *help, size_t offset)
+{
+	GSList *tmp;
+	unsigned long *counts;
+	int i;
+
+	append_family(str, name, "counter", help);
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		counts = G_STRUCT_MEMBER_P(server->stats, offset);
+		for (i = 0; i < ICB_STATS_TYPES; i++) {
+			if (counts[i] > 0)
+				append_type_sample(str, name, server, i,
+						   counts[i]);
+		}
+	}
+}
+
+static void append_connection(GString *str, GSList *list)
+{
+	GSList *tmp;
+	int phase;
+
+	append_family(str, "icb_connected", "gauge",
+		      "1 once connected to the server, 0 while connecting");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_connected", server,
+			      server->connected ? 1 : 0);
+	}
+
+	append_family(str, "icb_connect_phase_seconds", "gauge",
+		      "Time from starting to connect to each phase");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		for (phase = 0; phase < ICB_CONNECT_PHASES; phase++) {
+			if (server->connect_phase[phase] == 0)
+				continue;
+			append_series(str, "icb_connect_phase_seconds", "",
+				      server);
+			append_label(str, "phase", phase_names[phase]);
+			g_string_append(str, "} ");
+			append_value(str, server->connect_phase[phase] * USECS);
+			g_string_append_c(str, '\n');
+		}
+	}
+
+	append_family(str, "icb_dead_peers_total", "counter",
+		      "Connections to the network dropped for an unanswered "
+		      "lag ping and reconnected");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_dead_peers_total", server,
+			      server->connrec->dead_peers);
+	}
+}
+
+static void append_lag(GString *str, GSList *list)
+{
+	GSList *tmp;
+
+	append_family(str, "icb_lag_seconds", "gauge",
+		      "Last measured lag to the server");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_lag_seconds", server,
+			      server->lag / 1000.0);
+	}
+
+	append_family(str, "icb_lag_rtt_seconds", "histogram",
+		      "Round trip times of the lag pings");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		if (server->lag_histogram != NULL) {
+			append_histogram(str, "icb_lag_rtt_seconds", server,
+					 NULL, NULL, server->lag_histogram,
+					 USECS);
+		}
+	}
+}
+
+static void append_traffic(GString *str, GSList *list)
+{
+	GSList *tmp;
+
+	append_packets(str, list, "icb_packets_received_total",
+		       "Packets received by type",
+		       G_STRUCT_OFFSET(ICB_STATS_REC, packets_in));
+	append_packets(str, list, "icb_received_bytes_total",
+		       "Bytes of packets received by type",
+		       G_STRUCT_OFFSET(ICB_STATS_REC, bytes_in));
+	append_packets(str, list, "icb_packets_sent_total",
+		       "Packets sent by type",
+		       G_STRUCT_OFFSET(ICB_STATS_REC, packets_out));
+	append_packets(str, list, "icb_sent_bytes_total",
+		       "Bytes of packets sent by type",
+		       G_STRUCT_OFFSET(ICB_STATS_REC, bytes_out));
+
+	append_family(str, "icb_socket_reads_total", "counter",
+		      "Reads from the server socket");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_socket_reads_total", server,
+			      server->stats->socket_reads);
+	}
+
+	append_family(str, "icb_read_deferred_total", "counter",
+		      "Times parsing was continued later as the read budget "
+		      "ran out");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_read_deferred_total", server,
+			      server->read_deferred);
+	}
+}
+
+static void append_queues(GString *str, GSList *list)
+{
+	GSList *tmp;
+	int lane;
+
+	append_family(str, "icb_sendq_bytes", "gauge",
+		      "Bytes waiting in each lane of the send queue");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		for (lane = 0; lane < ICB_SENDQ_LANES; lane++) {
+			if (server->sendq[lane] == NULL)
+				continue;
+			append_series(str, "icb_sendq_bytes", "", server);
+			append_label(str, "lane", lane_names[lane]);
+			g_string_append_printf(str, "} %d\n",
+					       (int) server->sendq[lane]->len -
+					       server->sendq_head[lane]);
+		}
+	}
+
+	append_family(str, "icb_sendq_sent_total", "counter",
+		      "Packets sent from each lane of the send queue");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		for (lane = 0; lane < ICB_SENDQ_LANES; lane++) {
+			append_series(str, "icb_sendq_sent_total", "", server);
+			append_label(str, "lane", lane_names[lane]);
+			g_string_append_printf(str, "} %lu\n",
+					       server->sendq_sent[lane]);
+		}
+	}
+
+	append_family(str, "icb_sendq_unwritten_bytes", "gauge",
+		      "Bytes released from the send queue but not yet taken "
+		      "by the socket");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		if (server->sendq_out != NULL) {
+			append_sample(str, "icb_sendq_unwritten_bytes", server,
+				      server->sendq_out->len);
+		}
+	}
+
+	append_family(str, "icb_sendq_high_bytes", "gauge",
+		      "Most bytes in memory in the send queue at once");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_sendq_high_bytes", server,
+			      server->sendq_high);
+	}
+
+	append_family(str, "icb_sendq_refused_total", "counter",
+		      "Messages refused as the send queue was full");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_sendq_refused_total", server,
+			      server->sendq_dropped);
+	}
+
+	append_family(str, "icb_sendq_refused_bytes_total", "counter",
+		      "Bytes of messages refused or lost from the spill file");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_sendq_refused_bytes_total", server,
+			      server->sendq_dropped_bytes);
+	}
+
+	append_family(str, "icb_sendq_spilled_bytes_total", "counter",
+		      "Bytes of messages queued in the spill file");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_sendq_spilled_bytes_total", server,
+			      server->sendq_spilled_bytes);
+	}
+
+	append_family(str, "icb_sendq_spill_bytes", "gauge",
+		      "Bytes in the spill file not yet read back");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_sendq_spill_bytes", server,
+			      server->sendq_spill_size);
+	}
+
+	append_family(str, "icb_requests_pending", "gauge",
+		      "Commands waiting for their reply");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_requests_pending", server,
+			      server->requests == NULL ? 0 :
+			      g_queue_get_length(server->requests));
+	}
+}
+
+static void append_nicks(GString *str, GSList *list)
+{
+	GSList *tmp;
+
+	append_family(str, "icb_nicklist_nicks", "gauge",
+		      "Nicks in the nicklist of the current group");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		if (server->group == NULL)
+			continue;
+		append_series(str, "icb_nicklist_nicks", "", server);
+		append_label(str, "group", server->group->name);
+		g_string_append_printf(str, "} %u\n",
+				       g_hash_table_size(server->group->nicks));
+	}
+
+	append_family(str, "icb_directory_users", "gauge",
+		      "Users known on the server");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_directory_users", server,
+			      server->directory == NULL ? 0 :
+			      g_hash_table_size(server->directory->users));
+	}
+
+	append_family(str, "icb_directory_bytes", "gauge",
+		      "Estimated memory used by the user directory");
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		append_sample(str, "icb_directory_bytes", server,
+			      icb_directory_size(server));
+	}
+}
+
+static void append_timings(GString *str, GSList *list)
+{
+	GSList *tmp;
+	char type_name[2];
+	int i;
+
+	append_histograms(str, list, "icb_read_seconds",
+			  "Time to read and frame a packet, one in 64 timed",
+			  G_STRUCT_OFFSET(ICB_STATS_REC, read_time), USECS);
+	append_histograms(str, list, "icb_dispatch_seconds",
+			  "Time to parse and handle a packet, one in 64 timed",
+			  G_STRUCT_OFFSET(ICB_STATS_REC, dispatch_time), USECS);
+
+	append_family(str, "icb_handler_seconds", "histogram",
+		      "Time to parse and handle a packet by type, one in 64 "
+		      "timed");
+	type_name[1] = '\0';
+	for (tmp = list; tmp != NULL; tmp = tmp->next) {
+		ICB_SERVER_REC *server = tmp->data;
+
+		for (i = 0; i < ICB_STATS_TYPES; i++) {
+			if (server->stats->handler_time[i] == NULL)
+				continue;
+			type_name[0] = 'a' + i;
+			append_histogram(str, "icb_handler_seconds", server,
+					 "type", type_name,
+					 server->stats->handler_time[i], USECS);
+		}
+	}
+
+	append_histograms(str, list, "icb_wakeup_packets",
+			  "Packets handled per socket wakeup",
+			  G_STRUCT_OFFSET(ICB_STATS_REC, wakeup_packets), 1);
+	append_histograms(str, list, "icb_sendq_depth_bytes",
+			  "Bytes in the send queue after adding a packet",
+			  G_STRUCT_OFFSET(ICB_STATS_REC, sendq_depth), 1);
+	append_histograms(str, list, "icb_who_sync_seconds",
+			  "Time from the nicklist /who to a synced nicklist",
+			  G_STRUCT_OFFSET(ICB_STATS_REC, who_sync), USECS);
+}
+
+char *icb_metrics_get(void)
+{
+	GSList *tmp, *list;
+	GString *str;
+
+	/* servers still connecting are in lookup_servers */
+	list = NULL;
+	for (tmp = lookup_servers; tmp != NULL; tmp = tmp->next) {
+		if (IS_ICB_SERVER(tmp->data) &&
+		    ICB_SERVER(tmp->data)->stats != NULL)
+			list = g_slist_prepend(list, tmp->data);
+	}
+	for (tmp = servers; tmp != NULL; tmp = tmp->next) {
+		if (IS_ICB_SERVER(tmp->data) &&
+		    ICB_SERVER(tmp->data)->stats != NULL)
+			list = g_slist_prepend(list, tmp->data);
+	}
+	list = g_slist_reverse(list);
+
+	str = g_string_sized_new(4096);
+	append_connection(str, list);
+	append_lag(str, list);
+	append_traffic(str, list);
+	append_queues(str, list);
+	append_nicks(str, list);
+	append_timings(str, list);
+
+	g_slist_free(list);
+	return g_string_free(str, FALSE);
+}
+
+static void client_destroy(METRICS_CLIENT_REC *client)
+{
+	clients = g_slist_remove(clients, client);
+
+	g_source_remove(client->tag);
+	g_io_channel_shutdown(client->handle, FALSE, NULL);
+	g_io_channel_unref(client->handle);
+	g_free(client->data);
+	g_free(client);
+}
+
+static void sig_client_write(METRICS_CLIENT_REC *client)
+{
+	int ret;
+
+	ret = write(g_io_channel_unix_get_fd(client->handle),
+		    client->data + client->pos, client->len - client->pos);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (ret > 0)
+		client->pos += ret;
+	if (ret <= 0 || client->pos == client->len)
+		client_destroy(client);
+}
+
+static void sig_listen(void)
+{
+	METRICS_CLIENT_REC *client;
+	int fd;
+
+	fd = accept(g_io_channel_unix_get_fd(listen_handle), NULL, NULL);
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	client = g_new0(METRICS_CLIENT_REC, 1);
+	client->handle = g_io_channel_unix_new(fd);
+	client->data = icb_metrics_get();
+	client->len = strlen(client->data);
+	client->tag = g_input_add(client->handle, G_INPUT_WRITE,
+				  (GInputFunction) sig_client_write, client);
+	clients = g_slist_prepend(clients, client);
+}
+
+static void metrics_close(void)
+{
+	while (clients != NULL)
+		client_destroy(clients->data);
+
+	if (listen_handle == NULL)
+		return;
+
+	g_source_remove(listen_tag);
+	g_io_channel_shutdown(listen_handle, FALSE, NULL);
+	g_io_channel_unref(listen_handle);
+	listen_handle = NULL;
+
+	unlink(listen_path);
+	g_free_and_null(listen_path);
+}
+
+static int metrics_open(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat statbuf;
+	mode_t old_umask;
+	int fd, ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return FALSE;
+	}
+
+	/* replace a stale socket, but nothing else */
+	if (lstat(path, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode))
+		unlink(path);
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return FALSE;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	old_umask = umask(077);
+	ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(old_umask);
+
+	if (ret < 0 || listen(fd, 5) < 0) {
+		close(fd);
+		return FALSE;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	listen_path = g_strdup(path);
+	listen_handle = g_io_channel_unix_new(fd);
+	listen_tag = g_input_add(listen_handle, G_INPUT_READ,
+				 (GInputFunction) sig_listen, NULL);
+	return TRUE;
+}
+
+static void read_settings(void)
+{
+	const char *setting;
+	char *path;
+
+	setting = settings_get_str("icb_metrics_socket");
+	path = *setting == '\0' ? NULL : convert_home(setting);
+
+	if (path == NULL)
+		g_free_and_null(failed_path);
+
+	if (g_strcmp0(path, listen_path) != 0 &&
+	    g_strcmp0(path, failed_path) != 0) {
+		metrics_close();
+		g_free_and_null(failed_path);
+		if (path != NULL && !metrics_open(path)) {
+			g_warning("icb_metrics_socket %s: %s", path,
+				  g_strerror(errno));
+			failed_path = g_strdup(path);
+		}
+	}
+	g_free(path);
+}
+
+void icb_metrics_init(void)
+{
+	settings_add_str("icb", "icb_metrics_socket", "");
+
+	read_settings();
+	signal_add("setup changed", (SIGNAL_FUNC) read_settings);
+}
+
+void icb_metrics_deinit(void)
+{
+	metrics_close();
+	g_free_and_null(failed_path);
+	signal_remove("setup changed", (SIGNAL_FUNC) read_settings);
+}
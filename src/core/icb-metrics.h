@@ -0,0 +1,17 @@
+#ifndef __ICB_METRICS_H
+#define __ICB_METRICS_H
+
+/*
+ * The counters of all ICB servers in the Prometheus text format. When
+ * icb_metrics_socket is set, they are written to every client connecting
+ * to that Unix socket, which is then closed. Nothing is done between
+ * scrapes.
+ */
+
+/* Metrics of all servers, the same text the socket serves */
+char *icb_metrics_get(void);
+
+void icb_metrics_init(void);
+void icb_metrics_deinit(void);
+
+#endif
@@ -20,9 +20,12 @@
 
 #include "module.h"
 #include "signals.h"
+#include "settings.h"
+#include "misc.h"
 
 #include "icb-channels.h"
 #include "icb-nicklist.h"
+#include "icb-trace.h"
 
 /* Add new nick to list*/
 NICK_REC *icb_nicklist_insert(ICB_CHANNEL_REC *channel, const char *nick,
@@ -42,3 +45,259 @@ NICK_REC *icb_nicklist_insert(ICB_CHANNEL_REC *channel, const char *nick,
 	nicklist_insert(CHANNEL(channel), rec);
 	return rec;
 }
+
+/* sync_nicks values */
+#define SYNC_LISTED	0x01	/* always set, so the value isn't NULL */
+#define SYNC_MOD	0x02
+#define SYNC_LIVE	0x04	/* was in the nicklist when it was added */
+#define SYNC_OP		0x08	/* in the nicklist with the other op status */
+
+/* nicks added per check of the time slice */
+#define SYNC_APPLY_BATCH 64
+
+/* The collected nicks are copied into one pool, which is freed in one
+   go when the sync ends or the group is left */
+static void nicklist_sync_free(ICB_CHANNEL_REC *channel)
+{
+	if (channel->sync_tag != 0) {
+		g_source_remove(channel->sync_tag);
+		channel->sync_tag = 0;
+	}
+	if (channel->sync_pending != NULL) {
+		g_ptr_array_free(channel->sync_pending, TRUE);
+		channel->sync_pending = NULL;
+	}
+
+	g_hash_table_destroy(channel->sync_nicks);
+	g_string_chunk_free(channel->sync_pool);
+	channel->sync_nicks = NULL;
+	channel->sync_pool = NULL;
+}
+
+/* Add the pending nicks until the time slice is used up, a slice of 0
+   adds all of them. Returns TRUE if some are left. */
+static int nicklist_sync_apply(ICB_CHANNEL_REC *channel, gint64 slice)
+{
+	GPtrArray *pending;
+	NICK_REC *rec;
+	gint64 started;
+	char *key;
+	void *value;
+	int count;
+
+	pending = channel->sync_pending;
+	started = g_get_monotonic_time();
+	count = 0;
+	while (pending->len > 0) {
+		if (slice > 0 && ++count % SYNC_APPLY_BATCH == 0 &&
+		    g_get_monotonic_time() - started >= slice)
+			return TRUE;
+
+		key = g_ptr_array_index(pending, pending->len - 1);
+		g_ptr_array_set_size(pending, pending->len - 1);
+
+		/* it may have left or arrived since it was listed */
+		value = g_hash_table_lookup(channel->sync_nicks, key);
+		if (value == NULL)
+			continue;
+
+		rec = nicklist_find(CHANNEL(channel), key);
+		if (rec != NULL) {
+			rec->op = (GPOINTER_TO_INT(value) & SYNC_MOD) != 0;
+		} else {
+			icb_nicklist_insert(channel, key,
+					    GPOINTER_TO_INT(value) & SYNC_MOD);
+			channel->sync_added++;
+		}
+	}
+
+	nicklist_sync_free(channel);
+	channel->sync_time = time(NULL);
+	ICB_TRACE3(who__sync__end, channel->name, channel->sync_added,
+		   channel->sync_removed);
+
+	signal_emit("icb nicklist synced", 3, channel,
+		    GINT_TO_POINTER(channel->sync_added),
+		    GINT_TO_POINTER(channel->sync_removed));
+	return FALSE;
+}
+
+static int nicklist_sync_idle(ICB_CHANNEL_REC *channel);
+
+/* Add a slice of the pending nicks, continue from an idle source */
+static void nicklist_sync_continue(ICB_CHANNEL_REC *channel)
+{
+	if (nicklist_sync_apply(channel, (gint64)
+				settings_get_time("icb_read_budget") * 1000)) {
+		channel->sync_tag = g_idle_add((GSourceFunc) nicklist_sync_idle,
+					       channel);
+	}
+}
+
+static int nicklist_sync_idle(ICB_CHANNEL_REC *channel)
+{
+	channel->sync_tag = 0;
+	nicklist_sync_continue(channel);
+	return FALSE;
+}
+
+void icb_nicklist_sync_begin(ICB_CHANNEL_REC *channel)
+{
+	g_return_if_fail(IS_ICB_CHANNEL(channel));
+
+	/* finish adding the nicks of the previous sync first */
+	if (channel->sync_pending != NULL)
+		nicklist_sync_apply(channel, 0);
+
+	ICB_TRACE1(who__sync__begin, channel->name);
+	channel->sync_live = channel->sync_ops = 0;
+	if (channel->sync_nicks != NULL) {
+		g_hash_table_remove_all(channel->sync_nicks);
+		g_string_chunk_clear(channel->sync_pool);
+		return;
+	}
+
+	channel->sync_nicks = g_hash_table_new((GHashFunc) g_istr_hash,
+					       (GEqualFunc) g_istr_equal);
+	channel->sync_pool = g_string_chunk_new(4096);
+}
+
+static void sync_uncount(ICB_CHANNEL_REC *channel, int flags)
+{
+	if (flags & SYNC_LIVE)
+		channel->sync_live--;
+	if (flags & SYNC_OP)
+		channel->sync_ops--;
+}
+
+/* Compare with the nicklist now, while the /who is still being read in
+   slices, so that the end of the sync has only the changes to apply */
+void icb_nicklist_sync_add(ICB_CHANNEL_REC *channel, const char *nick,
+			   int mod)
+{
+	NICK_REC *rec;
+	char *key;
+	void *value;
+	int flags;
+
+	if (channel->sync_nicks == NULL)
+		return;
+
+	/* an existing key is kept */
+	value = g_hash_table_lookup(channel->sync_nicks, nick);
+	if (value != NULL) {
+		sync_uncount(channel, GPOINTER_TO_INT(value));
+		key = (char *) nick;
+	} else {
+		key = g_string_chunk_insert(channel->sync_pool, nick);
+	}
+
+	flags = SYNC_LISTED | (mod ? SYNC_MOD : 0);
+	rec = nicklist_find(CHANNEL(channel), nick);
+	if (rec != NULL) {
+		flags |= SYNC_LIVE;
+		channel->sync_live++;
+		if (rec->op != (mod != 0)) {
+			flags |= SYNC_OP;
+			channel->sync_ops++;
+		}
+	} else if (channel->sync_pending != NULL && value == NULL) {
+		/* renamed while the listed nicks are being added */
+		g_ptr_array_add(channel->sync_pending, key);
+	}
+	g_hash_table_insert(channel->sync_nicks, key, GINT_TO_POINTER(flags));
+}
+
+void icb_nicklist_sync_remove(ICB_CHANNEL_REC *channel, const char *nick)
+{
+	void *value;
+
+	if (channel->sync_nicks == NULL)
+		return;
+
+	value = g_hash_table_lookup(channel->sync_nicks, nick);
+	if (value != NULL) {
+		sync_uncount(channel, GPOINTER_TO_INT(value));
+		g_hash_table_remove(channel->sync_nicks, nick);
+	}
+}
+
+/* The nicklist is renamed first */
+void icb_nicklist_sync_rename(ICB_CHANNEL_REC *channel, const char *oldnick,
+			      const char *newnick)
+{
+	void *value;
+
+	if (channel->sync_nicks == NULL)
+		return;
+
+	value = g_hash_table_lookup(channel->sync_nicks, oldnick);
+	if (value != NULL) {
+		icb_nicklist_sync_remove(channel, oldnick);
+		icb_nicklist_sync_add(channel, newnick,
+				      GPOINTER_TO_INT(value) & SYNC_MOD);
+	}
+}
+
+/* Remove the nicks that are gone and add the new ones, the rest of the
+   nicklist is left untouched. Unless nicks went away without a status
+   message, every nick in the nicklist was listed and only the new ones
+   and the changed op statuses need to be looked at. The removals are
+   done at once, the new nicks are added in time slices. */
+void icb_nicklist_sync_end(ICB_CHANNEL_REC *channel)
+{
+	GHashTableIter iter;
+	GSList *nicks, *tmp;
+	NICK_REC *rec;
+	void *key, *value;
+	int flags;
+
+	g_return_if_fail(IS_ICB_CHANNEL(channel));
+	if (channel->sync_nicks == NULL || channel->sync_pending != NULL)
+		return;
+
+	channel->sync_added = channel->sync_removed = 0;
+	if (channel->sync_live < (int) g_hash_table_size(channel->nicks)) {
+		nicks = nicklist_getnicks(CHANNEL(channel));
+		for (tmp = nicks; tmp != NULL; tmp = tmp->next) {
+			rec = tmp->data;
+
+			if (rec != channel->ownnick &&
+			    g_hash_table_lookup(channel->sync_nicks,
+						rec->nick) == NULL) {
+				nicklist_remove(CHANNEL(channel), rec);
+				channel->sync_removed++;
+			}
+		}
+		g_slist_free(nicks);
+	}
+
+	channel->sync_pending = g_ptr_array_new();
+	if (channel->sync_live < (int) g_hash_table_size(channel->sync_nicks) ||
+	    channel->sync_ops > 0) {
+		g_hash_table_iter_init(&iter, channel->sync_nicks);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			flags = GPOINTER_TO_INT(value);
+			if ((flags & (SYNC_LIVE | SYNC_OP)) != SYNC_LIVE)
+				g_ptr_array_add(channel->sync_pending, key);
+		}
+	}
+
+	nicklist_sync_continue(channel);
+}
+
+static void sig_channel_destroyed(ICB_CHANNEL_REC *channel)
+{
+	if (IS_ICB_CHANNEL(channel) && channel->sync_nicks != NULL)
+		nicklist_sync_free(channel);
+}
+
+void icb_nicklist_init(void)
+{
+	signal_add("channel destroyed", (SIGNAL_FUNC) sig_channel_destroyed);
+}
+
+void icb_nicklist_deinit(void)
+{
+	signal_remove("channel destroyed", (SIGNAL_FUNC) sig_channel_destroyed);
+}
@@ -27,6 +27,17 @@
 NICK_REC *icb_nicklist_insert(ICB_CHANNEL_REC *channel, const char *nick,
 			      int mod);
 
+/* Collect the members listed by a /who on the side, and apply only the
+   difference to the nicklist when it's done. Arrivals and departures
+   during the sync go through icb_nicklist_sync_add() and _remove(). */
+void icb_nicklist_sync_begin(ICB_CHANNEL_REC *channel);
+void icb_nicklist_sync_add(ICB_CHANNEL_REC *channel, const char *nick,
+			   int mod);
+void icb_nicklist_sync_remove(ICB_CHANNEL_REC *channel, const char *nick);
+void icb_nicklist_sync_rename(ICB_CHANNEL_REC *channel, const char *oldnick,
+			      const char *newnick);
+void icb_nicklist_sync_end(ICB_CHANNEL_REC *channel);
+
 void icb_nicklist_init(void);
 void icb_nicklist_deinit(void);
 
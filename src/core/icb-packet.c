@@ -0,0 +1,96 @@
+/*
+ icb-packet.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+
+/* Split the packet in data in place, the ^A separators are replaced with
+   nuls. data must be nul-terminated at data[len]. */
+void icb_packet_parse(ICB_PACKET_REC *packet, char *data, int len)
+{
+	char *end, *sep;
+	int count;
+
+	end = data + len;
+	packet->type = *data;
+	if (data < end)
+		data++;
+
+	for (count = 0;; count++) {
+		packet->fields[count] = data;
+		sep = count == ICB_PACKET_MAX_FIELDS-1 ? NULL :
+			memchr(data, '\001', end-data);
+		if (sep == NULL) {
+			packet->lengths[count++] = end-data;
+			break;
+		}
+
+		*sep = '\0';
+		packet->lengths[count] = sep-data;
+		data = sep+1;
+	}
+
+	packet->fields[count] = NULL;
+	packet->count = count;
+}
+
+/* "wl" : In a who listing, a line of output listing a user. Has the
+   following format:
+
+   Field 1: String indicating whether user is moderator or not. Usually
+	    "*" for moderator, and " " for not.
+   Field 2: Nickname of user.
+   Field 3: Number of seconds user has been idle.
+   Field 4: Response Time. No longer in use.
+   Field 5: Login Time. Unix time_t format. Seconds since Jan. 1, 1970 GMT.
+   Field 6: Username of user.
+   Field 7: Hostname of user.
+   Field 8: Registration status.
+
+   Returns FALSE if fields are missing. */
+int icb_who_parse(ICB_WHO_REC *who, const ICB_PACKET_REC *packet)
+{
+	char *const *args;
+
+	if (packet->count < 9)
+		return FALSE;
+	args = packet->fields + 1;
+
+	who->mod = args[0][0];
+	who->nick = args[1];
+	who->idle = args[2];
+	who->login = args[4];
+	who->user = args[5];
+	who->host = args[6];
+	who->status = args[7];
+	return TRUE;
+}
+
+/* Copy the first space separated word of str into buf */
+char *icb_get_word(const char *str, char *buf, size_t size)
+{
+	size_t len;
+
+	for (len = 0; str[len] != '\0' && str[len] != ' '; len++)
+		;
+	if (len >= size)
+		len = size-1;
+
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+	return buf;
+}
@@ -18,13 +18,23 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
 #include "module.h"
 #include "signals.h"
+#include "settings.h"
 #include "network.h"
 #include "net-sendbuffer.h"
 #include "rawlog.h"
 
 #include "icb-servers.h"
+#include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-capture.h"
+#include "icb-stats.h"
+#include "icb-trace.h"
 
 static char *signal_names[] = {
 	"login",	/* a */
@@ -45,19 +55,71 @@ static char *signal_names[] = {
 #define SIGNAL_FIRST 'a'
 #define SIGNALS_COUNT (sizeof(signal_names)/sizeof(signal_names[0]))
 
-#ifdef BLOCKING_SOCKETS
-#  define MAX_SOCKET_READS 1
-#else
-#  define MAX_SOCKET_READS 5
-#endif
+typedef struct {
+	const char *name;
+	int signal_id;
+} ICB_SIGNAL_REC;
+
+/* Known command output types and status categories, sorted so that the
+   entries starting with the same letter are next to each other. Anything
+   else falls back to emitting the signal by name. */
+static ICB_SIGNAL_REC cmdout_signals[] = {
+	{ "c" }, { "ch" }, { "co" }, { "ec" },
+	{ "gh" }, { "wg" }, { "wh" }, { "wl" }
+};
+
+static ICB_SIGNAL_REC status_signals[] = {
+	{ "arrive" }, { "away" }, { "boot" }, { "change" },
+	{ "depart" }, { "drop" }, { "fyi" }, { "message" },
+	{ "name" }, { "no-pass" }, { "notify" }, { "pass" },
+	{ "register" }, { "sign-off" }, { "sign-on" }, { "status" },
+	{ "timeout" }, { "topic" }
+};
 
-static void icb_send_cmd(ICB_SERVER_REC *server, int type, ...)
+#define CMDOUT_COUNT G_N_ELEMENTS(cmdout_signals)
+#define STATUS_COUNT G_N_ELEMENTS(status_signals)
+
+/* first table entry for each letter a-z, or -1 */
+static int cmdout_index[26], status_index[26];
+
+static int event_signals[SIGNALS_COUNT];
+static int signal_default_cmdout, signal_default_status;
+
+/* time (usecs) and bytes that may be read per main loop wakeup */
+static int read_budget_time, read_budget_size;
+
+/* Append len bytes of data to the packet being built in sendbuf */
+static void sendbuf_append(ICB_SERVER_REC *server, int *pos,
+			   const char *data, int len)
+{
+	/* +2 == ^A + \0 at end of buffer */
+	if (*pos+len+2 > server->sendbuf_size) {
+		server->sendbuf_size += len + 128;
+		server->sendbuf = g_realloc(server->sendbuf,
+					    server->sendbuf_size);
+	}
+
+	memcpy(server->sendbuf + *pos, data, len);
+	*pos += len;
+}
+
+/* Terminate the packet in sendbuf and queue it on lane, returns the
+   icb_sendq_add() result */
+static int sendbuf_send(ICB_SERVER_REC *server, int lane, int pos)
+{
+        server->sendbuf[pos++] = '\0';
+	return icb_sendq_add(server, lane, server->sendbuf+1, pos-1);
+}
+
+/* Build a packet of type from the nul-terminated fields and queue it
+   on lane. Returns FALSE if the connection was lost. */
+static int icb_send_cmd(ICB_SERVER_REC *server, int lane, int type, ...)
 {
         const char *arg;
 	va_list va;
-        int pos, len, startpos;
+        int pos;
 
-	g_return_if_fail(IS_ICB_SERVER(server));
+	g_return_val_if_fail(IS_ICB_SERVER(server), FALSE);
 
 	server->sendbuf[1] = type;
 	pos = 2;
@@ -68,49 +130,20 @@ static void icb_send_cmd(ICB_SERVER_REC *server, int type, ...)
 		if (arg == NULL)
 			break;
 
-		len = strlen(arg);
-                /* +2 == ^A + \0 at end of buffer */
-		if (pos+len+2 > server->sendbuf_size) {
-                        server->sendbuf_size += len + 128;
-			server->sendbuf = g_realloc(server->sendbuf,
-						    server->sendbuf_size);
-		}
-
 		if (pos != 2) {
 			/* separate fields with ^A */
-                        server->sendbuf[pos++] = '\001';
+			sendbuf_append(server, &pos, "\001", 1);
 		}
-
-		memcpy(server->sendbuf+pos, arg, len);
-		pos += len;
+		sendbuf_append(server, &pos, arg, strlen(arg));
 	}
 	va_end(va);
 
-        server->sendbuf[pos++] = '\0';
-	rawlog_output(server->rawlog, (char *) server->sendbuf+1);
-
-	startpos = 0;
-	while (startpos < pos) {
-		len = pos-startpos-1;
-		if (len > 255) len = 255;
-
-		server->sendbuf[startpos] = len > 255 ? 0 : len;
-
-		if (net_sendbuffer_send(server->handle,
-					server->sendbuf+startpos, len+1) == -1) {
-			/* something bad happened */
-			server->connection_lost = TRUE;
-			server_disconnect(SERVER(server));
-			break;
-		}
-
-                startpos += 256;
-	}
+	return sendbuf_send(server, lane, pos) != ICB_SENDQ_LOST;
 }
 
 static void icb_login(ICB_SERVER_REC *server)
 {
-	icb_send_cmd(server, 'a',
+	icb_send_cmd(server, ICB_SENDQ_CONTROL, 'a',
 		     server->connrec->username,
 		     server->connrec->nick,
 		     server->connrec->channels,
@@ -119,281 +152,628 @@ static void icb_login(ICB_SERVER_REC *server)
 		     NULL);
 }
 
+/* Returns how much of the len bytes of text to send in the next packet,
+   which can hold at most max bytes. */
+static int split_length(const char *text, int len, int max)
+{
+	int i, cut;
+
+	if (len <= max)
+		return len;
+
+	/* try to split on a word boundary */
+	for (i = 1; i < 128 && i < max; i++) {
+		if (isspace((unsigned char) text[max - i]))
+			return max - i + 1;
+	}
+
+	/* don't split in the middle of an UTF-8 sequence */
+	cut = max;
+	while (cut > 0 && ((unsigned char) text[cut] & 0xc0) == 0x80)
+		cut--;
+	return cut > 0 ? cut : max;
+}
+
+/* Bytes the packets of text split into max byte chunks take in the send
+   queue, each chunk with overhead bytes of framing and fields */
+static int split_queued_size(const char *text, int len, int max,
+			     int overhead)
+{
+	int size, chunk;
+
+	size = 0;
+	while (len > 0) {
+		chunk = split_length(text, len, max);
+		size += chunk + overhead;
+		text += chunk;
+		len -= chunk;
+	}
+	return size;
+}
+
 void icb_send_open_msg(ICB_SERVER_REC *server, const char *text)
 {
-	size_t remain;
+	int pos, len, max, chunk;
 
 	/*
-	 * ICB has 255 byte line length limit, and public messages are sent
-	 * out with our nickname, so split text accordingly.
+	 * ICB has 255 byte packet length limit, and public messages are
+	 * sent out with our nickname, so split text accordingly.
 	 *
-	 * 250 = 255 - 'b' - 1 space after nick - ^A - nul - extra
+	 * 252 = 255 - 'b' - ^A after nick - nul
 	 *
-	 * Taken from ircII's icb.c, thanks phone :-)
+	 * Based on ircII's icb.c, thanks phone :-)
 	 */
-	remain = 250 - strlen(server->connrec->nick);
-
-	while(*text) {
-		char buf[256], *sendbuf;
-		size_t len, copylen;
-
-		len = strlen(text);
-		copylen = remain;
-		if (len > remain) {
-			int i;
-
-			/* try to split on a word boundary */
-			for (i = 1; i < 128 && i < len; i++) {
-				if (isspace(text[remain - i])) {
-					copylen -= i - 1;
-					break;
-				}
-			}
-			strncpy(buf, text, copylen);
-			buf[copylen] = 0;
-			sendbuf = buf;
-		} else {
-			sendbuf = (char *)text;
-		}
-		icb_send_cmd(server, 'b', sendbuf, NULL);
-		text += len > copylen ? copylen : len;
+	max = 252 - strlen(server->connrec->nick);
+	if (max < 1)
+		max = 1;
+
+	/* length byte, 'b' and nul around each chunk */
+	len = strlen(text);
+	if (!icb_sendq_reserve(server, split_queued_size(text, len, max, 3)))
+		return;
+
+	while (len > 0) {
+		chunk = split_length(text, len, max);
+
+		server->sendbuf[1] = 'b';
+		pos = 2;
+		sendbuf_append(server, &pos, text, chunk);
+		if (sendbuf_send(server, ICB_SENDQ_BULK, pos) !=
+		    ICB_SENDQ_QUEUED)
+			break;
+
+		text += chunk;
+		len -= chunk;
 	}
 }
 
 void icb_send_private_msg(ICB_SERVER_REC *server, const char *target,
 		const char *text)
 {
-	size_t mylen, targlen, remain;
+	int pos, len, max, targlen, chunk;
 
 	/*
-	 * ICB has 255 byte line length limit.  Private messages are sent
-	 * out with our nickname, but received with the target nickname,
-	 * so deduct the larger of the two in addition to other parts.
+	 * ICB has 255 byte packet length limit.  Private messages are sent
+	 * out with the target nickname, but received with our nickname,
+	 * so the text has to fit in both.
 	 *
-	 * 248 = 255 - 'hm' - 1 space after nick - ^A's - nul - extra
+	 * 250 = 255 - 'h' - 'm' - ^A - space after target - nul
+	 * 252 = 255 - 'c' - ^A after nick - nul
 	 *
-	 * Taken from ircII's icb.c, thanks phone :-)
+	 * Based on ircII's icb.c, thanks phone :-)
 	 */
-	mylen = strlen(server->connrec->nick);
 	targlen = strlen(target);
-	if (mylen > targlen) {
-		remain = 248 - mylen;
-	} else {
-		remain = 248 - targlen;
-	}
-	while(*text) {
-		char buf[256], *sendbuf;
-		size_t len, copylen;
-
-		len = strlen(text);
-		copylen = remain;
-		if (len > remain) {
-			int i;
-
-			/* try to split on a word boundary */
-			for (i = 1; i < 128 && i < len; i++) {
-				if (isspace(text[remain - i])) {
-					copylen -= i - 1;
-					break;
-				}
-			}
-			strncpy(buf, text, copylen);
-			buf[copylen] = 0;
-			sendbuf = g_strconcat(target, " ", buf, NULL);
-		} else {
-			sendbuf = g_strconcat(target, " ", text, NULL);
-		}
-		icb_send_cmd(server, 'h', "m", sendbuf, NULL);
-		text += len > copylen ? copylen : len;
+	max = MIN(250 - targlen, 252 - (int) strlen(server->connrec->nick));
+	if (max < 1)
+		max = 1;
+
+	/* length byte, 'h', "m^A", space and nul around each chunk */
+	len = strlen(text);
+	if (!icb_sendq_reserve(server, split_queued_size(text, len, max,
+							 targlen + 6)))
+		return;
+
+	while (len > 0) {
+		chunk = split_length(text, len, max);
+
+		server->sendbuf[1] = 'h';
+		pos = 2;
+		sendbuf_append(server, &pos, "m\001", 2);
+		sendbuf_append(server, &pos, target, targlen);
+		sendbuf_append(server, &pos, " ", 1);
+		sendbuf_append(server, &pos, text, chunk);
+		if (sendbuf_send(server, ICB_SENDQ_BULK, pos) !=
+		    ICB_SENDQ_QUEUED)
+			break;
+
+		text += chunk;
+		len -= chunk;
 	}
 }
 
-void icb_command(ICB_SERVER_REC *server, const char *cmd,
-		 const char *args, const char *id)
+int icb_command(ICB_SERVER_REC *server, const char *cmd,
+		const char *args, const char *id)
 {
-        icb_send_cmd(server, 'h', cmd, args, id, NULL);
+        return icb_send_cmd(server, ICB_SENDQ_COMMAND, 'h', cmd, args, id, NULL);
 }
 
 void icb_protocol(ICB_SERVER_REC *server, const char *level,
 		  const char *hostid, const char *clientid)
 {
-	icb_send_cmd(server, 'j', level, hostid, clientid, NULL);
+	icb_send_cmd(server, ICB_SENDQ_CONTROL, 'j', level, hostid, clientid, NULL);
 }
 
 void icb_ping(ICB_SERVER_REC *server, const char *id)
 {
-	icb_send_cmd(server, 'l', id, NULL);
+	icb_send_cmd(server, ICB_SENDQ_CONTROL, 'l', id, NULL);
+}
+
+int icb_ping_barrier(ICB_SERVER_REC *server, const char *id)
+{
+	/* queued with the commands, so it can't overtake them */
+	return icb_send_cmd(server, ICB_SENDQ_COMMAND, 'l', id, NULL);
 }
 
 void icb_pong(ICB_SERVER_REC *server, const char *id)
 {
-	icb_send_cmd(server, 'm', id, NULL);
+	icb_send_cmd(server, ICB_SENDQ_CONTROL, 'm', id, NULL);
 }
 
 void icb_noop(ICB_SERVER_REC *server)
 {
-	icb_send_cmd(server, 'n', NULL);
+	icb_send_cmd(server, ICB_SENDQ_CONTROL, 'n', NULL);
 }
 
-static void icb_server_event(ICB_SERVER_REC *server, const char *data)
+static void signal_table_init(ICB_SIGNAL_REC *table, int count, int *index,
+			      const char *prefix)
 {
-	char name[100];
+	char *name;
+	int i;
 
-	if (*data < SIGNAL_FIRST || *data >= SIGNAL_FIRST + SIGNALS_COUNT)
-		return; /* unknown packet type */
+	for (i = 0; i < 26; i++)
+		index[i] = -1;
+
+	for (i = count-1; i >= 0; i--) {
+		name = g_strconcat(prefix, table[i].name, NULL);
+		table[i].signal_id = signal_get_uniq_id(name);
+		g_free(name);
 
-	strcpy(name, "icb event ");
-        strcat(name, signal_names[*data - SIGNAL_FIRST]);
-        signal_emit(name, 2, server, data+1);
+		index[table[i].name[0] - 'a'] = i;
+	}
 }
 
-/* Read one ICB packet. Returns 1 if got it, 0 if not or -1 if disconnected */
-static int icb_read_packet(ICB_SERVER_REC *server, int read_socket)
+static ICB_SIGNAL_REC *signal_table_find(ICB_SIGNAL_REC *table, int count,
+					 const int *index, const char *name)
 {
-	char tmpbuf[512];
-	int ret, pos, wpos, size;
+	int i, c;
 
-	if (server->recvbuf_next_packet > 0) {
-                /* remove the last packet from buffer */
-		g_memmove(server->recvbuf,
-			  server->recvbuf+server->recvbuf_next_packet,
-			  server->recvbuf_pos - server->recvbuf_next_packet);
-                server->recvbuf_pos -= server->recvbuf_next_packet;
-                server->recvbuf_next_packet = 0;
-	}
+	c = g_ascii_tolower(*name);
+	if (c < 'a' || c > 'z')
+		return NULL;
 
-	ret = !read_socket ? 0 :
-		net_receive(net_sendbuffer_handle(server->handle),
-			    tmpbuf, sizeof(tmpbuf));
-	if (ret > 0) {
-		if (server->recvbuf_pos + ret > server->recvbuf_size) {
-			server->recvbuf_size += ret + 256;
-			server->recvbuf = g_realloc(server->recvbuf,
-						    server->recvbuf_size);
-		}
-		memcpy(server->recvbuf+server->recvbuf_pos, tmpbuf, ret);
-                server->recvbuf_pos += ret;
+	for (i = index[c - 'a']; i >= 0 && i < count &&
+	     table[i].name[0] == c; i++) {
+		if (g_ascii_strcasecmp(table[i].name, name) == 0)
+			return &table[i];
 	}
+	return NULL;
+}
+
+/* Emit "<prefix><name>" for a packet the tables don't know about */
+static int signal_emit_unknown(const char *prefix, const char *name,
+			       ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	char signal[100], *p;
+
+	g_strlcpy(signal, prefix, sizeof(signal));
+	p = signal + strlen(signal);
+	for (; *name != '\0' && p < signal + sizeof(signal) - 1; name++)
+		*p++ = g_ascii_tolower(*name);
+	*p = '\0';
+
+	return signal_emit(signal, 2, server, packet);
+}
+
+static void icb_server_event(ICB_SERVER_REC *server, char *data, int len)
+{
+	ICB_PACKET_REC packet;
+
+	if (*data < SIGNAL_FIRST || *data >= SIGNAL_FIRST + SIGNALS_COUNT)
+		return; /* unknown packet type */
+
+	ICB_TRACE3(packet__dispatch, server->tag, *data, len);
+	icb_packet_parse(&packet, data, len);
+
+	ICB_TRACE3(handler__entry, server->tag, packet.type, "");
+	signal_emit_id(event_signals[packet.type - SIGNAL_FIRST], 2,
+		       server, &packet);
+#ifdef HAVE_USDT
+	/* the handlers may have disconnected and freed server */
+	if (g_slist_find(servers, server) != NULL)
+		ICB_TRACE3(handler__return, server->tag, packet.type, "");
+#endif
+}
+
+/* Combine the 256B blocks of the packet at the read cursor into one
+   nul-terminated block, in place. Returns the packet length, or -1 if the
+   whole packet hasn't been received yet. */
+static int icb_frame_packet(ICB_SERVER_REC *server, char **packet)
+{
+	unsigned char *buf;
+	int pos, wpos, size, last, blocks;
+
+	buf = server->recvbuf;
 
 	/* check that we have a full packet */
-	pos = 0;
-	while (pos < server->recvbuf_pos) {
-		if (server->recvbuf[pos] != 0) {
-			pos += server->recvbuf[pos];
+	pos = server->recvbuf_start;
+	for (;;) {
+		if (pos >= server->recvbuf_pos)
+			return -1;
+		if (buf[pos] != 0) {
+			if (pos + buf[pos] >= server->recvbuf_pos)
+				return -1;
 			break;
 		}
 		pos += 256;
 	}
 
-	if (pos >= server->recvbuf_pos) {
-		/* nope */
+	/* drop the length bytes - the data only ever moves backwards
+	   inside the packet itself, the rest of the buffer stays put */
+	pos = wpos = server->recvbuf_start;
+	blocks = 0;
+	do {
+		size = buf[pos];
+		last = size != 0;
+		if (!last) {
+			size = 255;
+			blocks++;
+		}
+
+		g_memmove(buf+wpos, buf+pos+1, size);
+		pos += size+1;
+		wpos += size;
+	} while (!last);
+
+	buf[wpos] = '\0';
+	*packet = (char *) buf + server->recvbuf_start;
+	size = wpos - server->recvbuf_start;
+	server->stats->blocks_in += blocks;
+	ICB_TRACE2(packet__framed, size, blocks);
+
+	server->recvbuf_start = pos;
+	if (server->recvbuf_start == server->recvbuf_pos)
+		server->recvbuf_start = server->recvbuf_pos = 0;
+	return size;
+}
+
+/* Make room for at least size more bytes at the end of the receive
+   buffer */
+static void icb_reserve_recvbuf(ICB_SERVER_REC *server, int size)
+{
+	if (server->recvbuf_start > 0) {
+		/* only a partial packet is left, move it to the beginning
+		   of the buffer */
+		g_memmove(server->recvbuf,
+			  server->recvbuf+server->recvbuf_start,
+			  server->recvbuf_pos - server->recvbuf_start);
+		server->recvbuf_pos -= server->recvbuf_start;
+		server->recvbuf_start = 0;
+	}
+
+	if (server->recvbuf_size - server->recvbuf_pos < size) {
+		while (server->recvbuf_size - server->recvbuf_pos < size)
+			server->recvbuf_size *= 2;
+		server->recvbuf = g_realloc(server->recvbuf,
+					    server->recvbuf_size);
+	}
+}
+
+/* Read more data from the socket straight into the receive buffer.
+   Returns the number of bytes read or -1 if disconnected. */
+static int icb_fill_recvbuf(ICB_SERVER_REC *server)
+{
+	int ret;
+
+	icb_reserve_recvbuf(server, ICB_RECVBUF_MIN_READ);
+
+	ret = net_receive(net_sendbuffer_handle(server->handle),
+			  (char *) server->recvbuf+server->recvbuf_pos,
+			  server->recvbuf_size - server->recvbuf_pos);
+	server->stats->socket_reads++;
+	if (ret > 0) {
+		icb_capture(server, ICB_CAPTURE_IN,
+			    server->recvbuf+server->recvbuf_pos, ret);
+		server->recvbuf_pos += ret;
+	}
+	return ret;
+}
+
+/* Read one ICB packet. Returns the packet length if got it, 0 if not or
+   -1 if disconnected. If there's no full packet in the buffer and
+   read_socket is set, the socket is read until one is complete or there's
+   nothing more to read. The number of bytes read is added to *received. */
+static int icb_read_packet(ICB_SERVER_REC *server, int read_socket,
+			   int *received, char **packet)
+{
+	int len, ret;
+
+	while ((len = icb_frame_packet(server, packet)) <= 0) {
+		if (!read_socket)
+			return 0;
+
+		ret = icb_fill_recvbuf(server);
 		if (ret == -1) {
 			/* connection lost */
 			server->connection_lost = TRUE;
 			server_disconnect(SERVER(server));
 			return -1;
 		}
-		return 0;
+		if (ret == 0)
+			return 0;
+
+		*received += ret;
+#ifdef BLOCKING_SOCKETS
+		read_socket = FALSE;
+#endif
 	}
 
-	/* we have at least one full packet - combine the 256B blocks
-	   into one big nul-terminated block */
-        pos = wpos = 0;
-	while (pos < server->recvbuf_pos) {
-		if (server->recvbuf[pos] != 0) {
-                        size = server->recvbuf[pos];
-			g_memmove(server->recvbuf+wpos,
-				  server->recvbuf+pos+1, size);
-                        pos += size+1;
-			wpos += size;
-                        break;
-		}
+	return len;
+}
+
+/* Handle a packet, timing it if *timer is when its reading began. The
+   timer is then set to when the reading of the next packet begins if
+   that one is sampled, to 0 if not. Returns FALSE if the server got
+   disconnected. */
+static int icb_handle_packet(ICB_SERVER_REC *server, char *packet, int len,
+			     gint64 *timer)
+{
+	gint64 read_done, done;
+	int type;
+
+	type = *packet;
+	read_done = *timer != 0 ? g_get_monotonic_time() : 0;
+
+	rawlog_input(server->rawlog, packet);
+	icb_server_event(server, packet, len);
+
+	if (g_slist_find(servers, server) == NULL)
+		return FALSE;
+
+	done = 0;
+	if (read_done != 0) {
+		done = g_get_monotonic_time();
+		icb_stats_packet_time(server, type, read_done - *timer,
+				      done - read_done);
+	}
+	icb_stats_packet_in(server, type, len);
+
+	*timer = 0;
+	if (icb_stats_sample(server))
+		*timer = done != 0 ? done : g_get_monotonic_time();
+	return TRUE;
+}
+
+static int icb_parse_idle(ICB_SERVER_REC *server);
+
+/* Process packets until the socket is drained, or the per-wakeup time or
+   byte budget is used up. Whatever is left is continued from an idle
+   source so that one busy server can't starve the others. */
+static void icb_parse_packets(ICB_SERVER_REC *server, int read_socket)
+{
+	gint64 started, now, timer;
+	char *packet;
+	int len, received, backlog, count;
+
+	started = g_get_monotonic_time();
+	timer = icb_stats_sample(server) ? started : 0;
+	received = count = 0;
+
+	while ((len = icb_read_packet(server,
+				      read_socket &&
+				      received < read_budget_size,
+				      &received, &packet)) > 0) {
+		if (!icb_handle_packet(server, packet, len, &timer))
+			return; /* disconnected */
+		count++;
 
-		g_memmove(server->recvbuf+wpos, server->recvbuf+pos+1, 255);
-                pos += 256;
-                wpos += 255;
+		now = timer != 0 ? timer : g_get_monotonic_time();
+		if (received >= read_budget_size ||
+		    now - started >= read_budget_time) {
+			/* out of budget, continue later */
+			server->read_deferred++;
+			if (server->parse_tag == 0) {
+				server->parse_tag = g_idle_add((GSourceFunc)
+							       icb_parse_idle,
+							       server);
+			}
+			break;
+		}
 	}
 
-	server->recvbuf[wpos] = '\0';
-	server->recvbuf_next_packet = pos;
-        return 1;
+	if (len < 0)
+		return; /* disconnected */
+
+	backlog = server->recvbuf_pos - server->recvbuf_start;
+	if (backlog > server->read_max_backlog)
+		server->read_max_backlog = backlog;
+	icb_histogram_add(&server->stats->wakeup_packets, count);
 }
 
 static void icb_parse_incoming(ICB_SERVER_REC *server)
 {
-	int count;
+	server->read_wakeups++;
+	server->last_read = g_get_monotonic_time();
+	icb_parse_packets(server, TRUE);
+}
 
-        count = 0;
-	while (icb_read_packet(server, count < MAX_SOCKET_READS) > 0) {
-		rawlog_input(server->rawlog, (char *) server->recvbuf);
-                icb_server_event(server, (char *) server->recvbuf);
+static int icb_parse_idle(ICB_SERVER_REC *server)
+{
+	/* only the packets already buffered - if there's more in the
+	   socket the input callback gets called anyway */
+	server->parse_tag = 0;
+	icb_parse_packets(server, FALSE);
+	return FALSE;
+}
 
+int icb_protocol_feed(ICB_SERVER_REC *server, const void *data, int len)
+{
+	gint64 timer;
+	char *packet;
+	int plen, count, received;
+
+	icb_reserve_recvbuf(server, len);
+	memcpy(server->recvbuf+server->recvbuf_pos, data, len);
+	server->recvbuf_pos += len;
+
+	count = received = 0;
+	timer = icb_stats_sample(server) ? g_get_monotonic_time() : 0;
+	while ((plen = icb_read_packet(server, FALSE,
+				       &received, &packet)) > 0) {
+		if (!icb_handle_packet(server, packet, plen, &timer))
+			break;
 		count++;
-		if (g_slist_find(servers, server) == NULL)
-			break; /* disconnected */
+	}
+
+	return count;
+}
+
+void icb_connect_phase(ICB_SERVER_REC *server, int phase)
+{
+	g_return_if_fail(phase >= 0 && phase < ICB_CONNECT_PHASES);
+
+	if (server->connect_phase[phase] == 0) {
+		server->connect_phase[phase] =
+			g_get_monotonic_time() - server->connect_started;
+		ICB_TRACE3(connect__phase, server->tag, phase,
+			   server->connect_phase[phase]);
 	}
 }
 
 static void sig_server_connected(ICB_SERVER_REC *server)
 {
+	int fd, on;
+
 	if (!IS_ICB_SERVER(server))
                 return;
 
+	if (server->connrec->tcp_nodelay) {
+		fd = g_io_channel_unix_get_fd(net_sendbuffer_handle(server->handle));
+		on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+
 	server->readtag =
 		g_input_add(net_sendbuffer_handle(server->handle),
 			    G_INPUT_READ,
 			    (GInputFunction) icb_parse_incoming, server);
+	icb_connect_phase(server, ICB_CONNECT_TCP);
+	server->last_read = g_get_monotonic_time();
+
+	/* don't wait a round trip for the protocol packet */
+	if (server->connrec->fast_connect && !server->session_reconnect) {
+		server->login_sent = TRUE;
+		icb_login(server);
+	}
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	if (!IS_ICB_SERVER(server))
+		return;
+
+	if (server->parse_tag != 0) {
+		g_source_remove(server->parse_tag);
+		server->parse_tag = 0;
+	}
 }
 
-static void event_protocol(ICB_SERVER_REC *server, const char *data)
+static void event_protocol(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
+	icb_connect_phase(server, ICB_CONNECT_PROTOCOL);
+
 	/* ignore parameters - just send the login packet */
-        icb_login(server);
+	if (!server->login_sent)
+		icb_login(server);
 }
 
-static void event_login(ICB_SERVER_REC *server, const char *data)
+static void event_login(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
 	/* Login OK */
+	icb_connect_phase(server, ICB_CONNECT_LOGIN);
         server->connected = TRUE;
 	signal_emit("event connected", 1, server);
 }
 
-static void event_ping(ICB_SERVER_REC *server, const char *data)
+static void event_ping(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-        icb_pong(server, data);
+        icb_pong(server, packet->fields[0]);
 }
 
-static void event_cmdout(ICB_SERVER_REC *server, const char *data)
+static void event_cmdout(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	char **args, *event;
+	ICB_SIGNAL_REC *rec;
+	int handled;
+
+	rec = signal_table_find(cmdout_signals, CMDOUT_COUNT, cmdout_index,
+				packet->fields[0]);
+	ICB_TRACE3(handler__entry, server->tag, packet->type,
+		   packet->fields[0]);
+	handled = rec != NULL ?
+		signal_emit_id(rec->signal_id, 2, server, packet) :
+		signal_emit_unknown("icb cmdout ", packet->fields[0],
+				    server, packet);
+	if (!handled)
+		signal_emit_id(signal_default_cmdout, 2, server, packet);
+#ifdef HAVE_USDT
+	if (g_slist_find(servers, server) != NULL) {
+		ICB_TRACE3(handler__return, server->tag, packet->type,
+			   packet->fields[0]);
+	}
+#endif
+}
 
-	args = g_strsplit(data, "\001", -1);
-	if (args[0] != NULL) {
-		event = g_strdup_printf("icb cmdout %s", args[0]);
-		if (!signal_emit(event, 2, server, args+1))
-                        signal_emit("default icb cmdout", 2, server, args);
-                g_free(event);
+static void event_status(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_SIGNAL_REC *rec;
+	int handled;
+
+	rec = signal_table_find(status_signals, STATUS_COUNT, status_index,
+				packet->fields[0]);
+	ICB_TRACE3(handler__entry, server->tag, packet->type,
+		   packet->fields[0]);
+	handled = rec != NULL ?
+		signal_emit_id(rec->signal_id, 2, server, packet) :
+		signal_emit_unknown("icb status ", packet->fields[0],
+				    server, packet);
+	if (!handled)
+		signal_emit_id(signal_default_status, 2, server, packet);
+#ifdef HAVE_USDT
+	if (g_slist_find(servers, server) != NULL) {
+		ICB_TRACE3(handler__return, server->tag, packet->type,
+			   packet->fields[0]);
 	}
-        g_strfreev(args);
+#endif
 }
 
-static void event_status(ICB_SERVER_REC *server, const char *data)
+static void signals_init(void)
 {
-	char **args, *event;
+	char *name;
+	int i;
 
-	args = g_strsplit(data, "\001", -1);
-	if (args[0] != NULL) {
-		event = g_strdup_printf("icb status %s", g_ascii_strdown(args[0], strlen(args[0])));
-		if (!signal_emit(event, 2, server, args))
-                        signal_emit("default icb status", 2, server, args);
-                g_free(event);
+	for (i = 0; i < SIGNALS_COUNT; i++) {
+		name = g_strconcat("icb event ", signal_names[i], NULL);
+		event_signals[i] = signal_get_uniq_id(name);
+		g_free(name);
 	}
-        g_strfreev(args);
+
+	signal_table_init(cmdout_signals, CMDOUT_COUNT, cmdout_index,
+			  "icb cmdout ");
+	signal_table_init(status_signals, STATUS_COUNT, status_index,
+			  "icb status ");
+
+	signal_default_cmdout = signal_get_uniq_id("default icb cmdout");
+	signal_default_status = signal_get_uniq_id("default icb status");
+}
+
+static void read_settings(void)
+{
+	read_budget_time = settings_get_time("icb_read_budget") * 1000;
+	read_budget_size = settings_get_size("icb_read_budget_size");
+	if (read_budget_size < ICB_RECVBUF_MIN_READ)
+		read_budget_size = ICB_RECVBUF_MIN_READ;
 }
 
 void icb_protocol_init(void)
 {
+	settings_add_time("icb", "icb_read_budget", "20msecs");
+	settings_add_size("icb", "icb_read_budget_size", "256k");
+
+	read_settings();
+	signals_init();
+
+	signal_add("setup changed", (SIGNAL_FUNC) read_settings);
         signal_add("server connected", (SIGNAL_FUNC) sig_server_connected);
+        signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
         signal_add("icb event protocol", (SIGNAL_FUNC) event_protocol);
         signal_add("icb event login", (SIGNAL_FUNC) event_login);
         signal_add("icb event ping", (SIGNAL_FUNC) event_ping);
@@ -403,7 +783,9 @@ void icb_protocol_init(void)
 
 void icb_protocol_deinit(void)
 {
+	signal_remove("setup changed", (SIGNAL_FUNC) read_settings);
         signal_remove("server connected", (SIGNAL_FUNC) sig_server_connected);
+        signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
         signal_remove("icb event protocol", (SIGNAL_FUNC) event_protocol);
         signal_remove("icb event login", (SIGNAL_FUNC) event_login);
         signal_remove("icb event ping", (SIGNAL_FUNC) event_ping);
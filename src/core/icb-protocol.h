@@ -3,17 +3,34 @@
 
 #define ICB_PROTOCOL_LEVEL 1
 
+/* The receive buffer is read into directly, and grown whenever there's
+   less than ICB_RECVBUF_MIN_READ bytes of room left at its end */
+#define ICB_RECVBUF_SIZE 16384
+#define ICB_RECVBUF_MIN_READ 4096
+
 void icb_send_open_msg(ICB_SERVER_REC *server, const char *text);
 void icb_send_private_msg(ICB_SERVER_REC *server, const char *target,
 		const char *text);
-void icb_command(ICB_SERVER_REC *server, const char *cmd,
-		 const char *args, const char *id);
+/* Returns FALSE if sending it lost the connection and server is gone */
+int icb_command(ICB_SERVER_REC *server, const char *cmd,
+		const char *args, const char *id);
 void icb_protocol(ICB_SERVER_REC *server, const char *level,
 		  const char *hostid, const char *clientid);
 void icb_ping(ICB_SERVER_REC *server, const char *id);
+/* Ping sent after all the commands sent so far. The server answers in
+   order, so its pong means that all their output has been received.
+   Returns FALSE like icb_command(). */
+int icb_ping_barrier(ICB_SERVER_REC *server, const char *id);
 void icb_pong(ICB_SERVER_REC *server, const char *id);
 void icb_noop(ICB_SERVER_REC *server);
 
+/* Record how long it took to reach connect phase, unless it already was */
+void icb_connect_phase(ICB_SERVER_REC *server, int phase);
+
+/* Handle len bytes of data as if they were read from the server's socket.
+   Returns the number of complete packets that were processed. */
+int icb_protocol_feed(ICB_SERVER_REC *server, const void *data, int len);
+
 void icb_protocol_init(void);
 void icb_protocol_deinit(void);
 
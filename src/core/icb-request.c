@@ -0,0 +1,152 @@
+/*
+ icb-request.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "signals.h"
+
+#include "icb-servers.h"
+#include "icb-protocol.h"
+#include "icb-request.h"
+
+const char *icb_request(ICB_SERVER_REC *server, const char *cmd,
+			const char *args, ICB_REQUEST_FUNC func, void *data,
+			GDestroyNotify destroy)
+{
+	ICB_REQUEST_REC *req;
+
+	g_return_val_if_fail(IS_ICB_SERVER(server), NULL);
+	g_return_val_if_fail(func != NULL, NULL);
+
+	req = g_new0(ICB_REQUEST_REC, 1);
+	req->id = g_strdup_printf("irssi-%u", ++server->request_serial);
+	req->func = func;
+	req->data = data;
+	req->destroy = destroy;
+	req->sent = g_get_monotonic_time();
+
+	if (server->requests == NULL)
+		server->requests = g_queue_new();
+	g_queue_push_tail(server->requests, req);
+
+	/* when the connection is lost, the request is gone with it */
+	if (!icb_ping_barrier(server, req->id) ||
+	    !icb_command(server, cmd, args != NULL ? args : "", req->id) ||
+	    !icb_ping_barrier(server, req->id))
+		return NULL;
+	return req->id;
+}
+
+static ICB_REQUEST_REC *request_find(ICB_SERVER_REC *server, const char *id)
+{
+	ICB_REQUEST_REC *req;
+	GList *tmp;
+
+	if (server->requests == NULL || id == NULL)
+		return NULL;
+
+	for (tmp = server->requests->head; tmp != NULL; tmp = tmp->next) {
+		req = tmp->data;
+		if (strcmp(req->id, id) == 0)
+			return req;
+	}
+	return NULL;
+}
+
+static void request_free(ICB_REQUEST_REC *req)
+{
+	if (req->destroy != NULL)
+		req->destroy(req->data);
+	g_free(req->id);
+	g_free(req);
+}
+
+static void request_done(ICB_SERVER_REC *server, ICB_REQUEST_REC *req)
+{
+	g_queue_remove(server->requests, req);
+	if (server->request_active == req)
+		server->request_active = NULL;
+
+	server->requests_done++;
+	server->request_time += g_get_monotonic_time() - req->sent;
+
+	req->func(server, NULL, req->data);
+	request_free(req);
+}
+
+static void event_cmdout(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_REQUEST_REC *req;
+
+	if (server->requests == NULL)
+		return;
+
+	req = packet->count > 2 ?
+		request_find(server, packet->fields[packet->count-1]) : NULL;
+	if (req == NULL)
+		req = server->request_active;
+	if (req != NULL)
+		req->func(server, packet, req->data);
+}
+
+/* The first pong of a request starts its reply, the second ends it */
+static void event_pong(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	ICB_REQUEST_REC *req;
+
+	req = request_find(server, packet->fields[0]);
+	if (req == NULL)
+		return;
+
+	if (!req->started) {
+		req->started = TRUE;
+		server->request_active = req;
+	} else {
+		request_done(server, req);
+	}
+	signal_stop();
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	ICB_REQUEST_REC *req;
+
+	if (!IS_ICB_SERVER(server) || server->requests == NULL)
+		return;
+
+	server->request_active = NULL;
+	while ((req = g_queue_pop_head(server->requests)) != NULL) {
+		req->func(server, NULL, req->data);
+		request_free(req);
+	}
+	g_queue_free(server->requests);
+	server->requests = NULL;
+}
+
+void icb_request_init(void)
+{
+	signal_add_first("icb event cmdout", (SIGNAL_FUNC) event_cmdout);
+	signal_add_first("icb event pong", (SIGNAL_FUNC) event_pong);
+	signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
+
+void icb_request_deinit(void)
+{
+	signal_remove("icb event cmdout", (SIGNAL_FUNC) event_cmdout);
+	signal_remove("icb event pong", (SIGNAL_FUNC) event_pong);
+	signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
@@ -0,0 +1,36 @@
+#ifndef __ICB_REQUEST_H
+#define __ICB_REQUEST_H
+
+/*
+ * Commands with their replies routed back to whoever sent them, so that
+ * many can be in flight at once. Each command is sent with a message id
+ * between two pings with the same id. The server answers in order, so
+ * the command output between the two pongs belongs to the request, as
+ * does any command output carrying its id.
+ */
+
+/* Called for each command output packet of the reply, and once more with
+   packet NULL when the reply is complete or the server disconnected.
+   Calling signal_stop() keeps the packet from being handled as usual. */
+typedef void (*ICB_REQUEST_FUNC)(ICB_SERVER_REC *server,
+				 ICB_PACKET_REC *packet, void *data);
+
+typedef struct {
+	char *id;
+	ICB_REQUEST_FUNC func;
+	void *data;
+	GDestroyNotify destroy;	/* called for data when done */
+	gint64 sent;
+	int started;		/* the first pong has arrived */
+} ICB_REQUEST_REC;
+
+/* Send command with args, returns the id of the request or NULL if the
+   connection was lost while sending it */
+const char *icb_request(ICB_SERVER_REC *server, const char *cmd,
+			const char *args, ICB_REQUEST_FUNC func, void *data,
+			GDestroyNotify destroy);
+
+void icb_request_init(void);
+void icb_request_deinit(void);
+
+#endif
@@ -0,0 +1,561 @@
+/*
+ icb-sendq.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "module.h"
+#include "signals.h"
+#include "settings.h"
+#include "rawlog.h"
+#include "network.h"
+#include "net-sendbuffer.h"
+
+#include "icb-servers.h"
+#include "icb-sendq.h"
+#include "icb-capture.h"
+#include "icb-stats.h"
+#include "icb-trace.h"
+
+/*
+ * Outgoing packets are queued in three lanes which are always sent in
+ * order: control packets (login, protocol, ping, pong, noop) are never
+ * held back, commands and bulk message text share a token bucket so that
+ * we stay below the server's flood limits. A token is used per packet,
+ * up to max_cmds_at_once tokens are kept and one is added every
+ * cmd_queue_speed milliseconds.
+ *
+ * Paced lanes keep a read offset so releasing packets from the front of
+ * a long paste doesn't move the rest of it.
+ *
+ * Released packets are written to the socket directly, what it doesn't
+ * take is kept in sendq_out and nothing more is released until it's
+ * gone. Message text beyond icb_sendq_max_size of queued bytes is
+ * refused or spilled to a temporary file as icb_sendq_full says, so a
+ * runaway paste or script can't grow the queues without bounds.
+ */
+
+/* most bytes handed to the socket in one write */
+#define SENDQ_WRITE_MAX 65536
+
+/* icb_sendq_full values */
+enum {
+	SENDQ_FULL_BLOCK,	/* refuse, "icb send queue full" until drained */
+	SENDQ_FULL_DROP,	/* refuse quietly */
+	SENDQ_FULL_SPILL	/* queue in a temporary file */
+};
+
+static int sendq_max_size, sendq_full_policy;
+
+static int icb_sendq_flush_idle(ICB_SERVER_REC *server);
+static int icb_sendq_pace(ICB_SERVER_REC *server);
+
+/* Length of the framed packet at pos */
+static int packet_length(const GString *queue, int pos)
+{
+	int start;
+
+	start = pos;
+	while ((unsigned char) queue->str[pos] == 0)
+		pos += 256;
+	pos += (unsigned char) queue->str[pos] + 1;
+	return pos - start;
+}
+
+static void tokens_refill(ICB_SERVER_REC *server)
+{
+	gint64 now, speed;
+	int add;
+
+	now = g_get_monotonic_time();
+	speed = (gint64) server->cmd_queue_speed * 1000;
+	add = (now - server->sendq_refilled) / speed;
+	if (add <= 0)
+		return;
+
+	server->sendq_tokens += add;
+	server->sendq_refilled += add * speed;
+	if (server->sendq_tokens >= server->max_cmds_at_once) {
+		server->sendq_tokens = server->max_cmds_at_once;
+		server->sendq_refilled = now;
+	}
+}
+
+static void sendq_lost(ICB_SERVER_REC *server)
+{
+	/* something bad happened */
+	server->connection_lost = TRUE;
+	server_disconnect(SERVER(server));
+}
+
+static int sendq_writable(ICB_SERVER_REC *server)
+{
+	icb_sendq_flush(server);
+	return TRUE;
+}
+
+/* Write what the socket didn't take before. Returns FALSE if the
+   connection was lost. */
+static int sendq_write_out(ICB_SERVER_REC *server)
+{
+	GString *out;
+	int ret;
+
+	out = server->sendq_out;
+	ret = net_transmit(net_sendbuffer_handle(server->handle),
+			   out->str, out->len);
+	if (ret == -1) {
+		sendq_lost(server);
+		return FALSE;
+	}
+
+	g_string_erase(out, 0, ret);
+	if (out->len == 0 && server->write_tag != 0) {
+		g_source_remove(server->write_tag);
+		server->write_tag = 0;
+	}
+	return TRUE;
+}
+
+static int sendq_write(ICB_SERVER_REC *server, const char *data, int len)
+{
+	GIOChannel *handle;
+	int ret;
+
+	handle = net_sendbuffer_handle(server->handle);
+	ret = net_transmit(handle, data, len);
+	if (ret == -1) {
+		sendq_lost(server);
+		return FALSE;
+	}
+
+	if (ret < len) {
+		/* keep the rest until the socket is writable again */
+		g_string_append_len(server->sendq_out, data + ret, len - ret);
+		if (server->write_tag == 0) {
+			server->write_tag =
+				g_input_add(handle, G_INPUT_WRITE,
+					    (GInputFunction) sendq_writable,
+					    server);
+		}
+	}
+
+	icb_capture(server, ICB_CAPTURE_OUT, data, len);
+	server->send_flushes++;
+	ICB_TRACE2(send__flush, server->tag, len);
+	return TRUE;
+}
+
+/* Send as many packets from the front of lane as there are tokens for,
+   or all of them if paced is FALSE, until the socket is full */
+static int sendq_flush_lane(ICB_SERVER_REC *server, int lane, int paced)
+{
+	GString *queue;
+	int start, pos, count;
+
+	queue = server->sendq[lane];
+	while (server->sendq_out->len == 0) {
+		start = pos = server->sendq_head[lane];
+		count = 0;
+		while (pos < queue->len && pos - start < SENDQ_WRITE_MAX &&
+		       (!paced || server->sendq_tokens > 0)) {
+			pos += packet_length(queue, pos);
+			if (paced)
+				server->sendq_tokens--;
+			count++;
+		}
+
+		if (pos == start)
+			break;
+
+		if (!sendq_write(server, queue->str + start, pos - start))
+			return FALSE;
+		server->sendq_sent[lane] += count;
+
+		if (pos == queue->len) {
+			g_string_truncate(queue, 0);
+			server->sendq_head[lane] = 0;
+		} else if (pos > queue->len / 2) {
+			/* most of it is sent, drop the sent part */
+			g_string_erase(queue, 0, pos);
+			server->sendq_head[lane] = 0;
+		} else {
+			server->sendq_head[lane] = pos;
+		}
+	}
+	return TRUE;
+}
+
+static void sendq_spill_close(ICB_SERVER_REC *server)
+{
+	fclose(server->sendq_spill);
+	server->sendq_spill = NULL;
+	server->sendq_spill_pos = server->sendq_spill_size = 0;
+}
+
+/* Append the framed packets in data to the spill file */
+static int sendq_spill_add(ICB_SERVER_REC *server, const char *data, int len)
+{
+	if (server->sendq_spill == NULL) {
+		server->sendq_spill = tmpfile();
+		if (server->sendq_spill == NULL)
+			return FALSE;
+	}
+
+	/* a failed write is overwritten by the next one */
+	if (fseek(server->sendq_spill, server->sendq_spill_pos +
+		  server->sendq_spill_size, SEEK_SET) != 0 ||
+	    fwrite(data, 1, len, server->sendq_spill) != (size_t) len)
+		return FALSE;
+
+	server->sendq_spill_size += len;
+	server->sendq_spilled_bytes += len;
+	return TRUE;
+}
+
+/* Move spilled packets back to the bulk lane until it holds half of
+   icb_sendq_max_size */
+static void sendq_spill_refill(ICB_SERVER_REC *server)
+{
+	GString *queue;
+	FILE *spill;
+	int start, block, len, failed;
+
+	spill = server->sendq_spill;
+	queue = server->sendq[ICB_SENDQ_BULK];
+	failed = fseek(spill, server->sendq_spill_pos, SEEK_SET) != 0;
+
+	while (!failed && server->sendq_spill_size > 0 &&
+	       (sendq_max_size == 0 ||
+		icb_sendq_queued(server) < sendq_max_size / 2)) {
+		/* blocks of the packet up to the last one */
+		start = queue->len;
+		do {
+			block = getc(spill);
+			if (block == EOF) {
+				failed = TRUE;
+				break;
+			}
+
+			len = block == 0 ? 255 : block;
+			g_string_append_c(queue, block);
+			g_string_set_size(queue, queue->len + len);
+			if (fread(queue->str + queue->len - len, 1, len,
+				  spill) != (size_t) len) {
+				failed = TRUE;
+				break;
+			}
+		} while (block == 0);
+
+		if (failed) {
+			g_string_truncate(queue, start);
+			break;
+		}
+		server->sendq_spill_pos += queue->len - start;
+		server->sendq_spill_size -= queue->len - start;
+	}
+
+	if (failed) {
+		/* can't read it back, count the rest as dropped */
+		server->sendq_dropped_bytes += server->sendq_spill_size;
+		server->sendq_spill_size = 0;
+	}
+	if (server->sendq_spill_size == 0)
+		sendq_spill_close(server);
+}
+
+/* Cork the socket while the lanes are written, if asked to */
+static void sendq_cork(ICB_SERVER_REC *server, int on)
+{
+#ifdef TCP_CORK
+	int fd;
+
+	if (!server->connrec->tcp_cork)
+		return;
+
+	fd = g_io_channel_unix_get_fd(net_sendbuffer_handle(server->handle));
+	setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
+
+int icb_sendq_flush(ICB_SERVER_REC *server)
+{
+	int ret, paced;
+
+	if (server->flush_tag != 0) {
+		g_source_remove(server->flush_tag);
+		server->flush_tag = 0;
+	}
+
+	if (server->sendq_out->len > 0) {
+		if (!sendq_write_out(server))
+			return FALSE;
+		if (server->sendq_out->len > 0) {
+			/* continued when the socket is writable */
+			return TRUE;
+		}
+	}
+
+	if (server->sendq_spill != NULL)
+		sendq_spill_refill(server);
+
+	sendq_cork(server, TRUE);
+	paced = server->cmd_queue_speed > 0;
+	if (paced)
+		tokens_refill(server);
+
+	ret = sendq_flush_lane(server, ICB_SENDQ_CONTROL, FALSE) &&
+		sendq_flush_lane(server, ICB_SENDQ_COMMAND, paced) &&
+		sendq_flush_lane(server, ICB_SENDQ_BULK, paced);
+	if (!ret)
+		return FALSE;
+
+	sendq_cork(server, FALSE);
+
+	if (server->sendq_full && server->sendq_spill == NULL &&
+	    icb_sendq_queued(server) <= sendq_max_size / 2) {
+		server->sendq_full = FALSE;
+		signal_emit("icb send queue drained", 1, server);
+	}
+
+	if (server->write_tag != 0)
+		return TRUE;
+
+	if (paced && server->pace_tag == 0 &&
+	    (icb_sendq_length(server, ICB_SENDQ_COMMAND) > 0 ||
+	     icb_sendq_length(server, ICB_SENDQ_BULK) > 0)) {
+		/* out of tokens, continue when the next one is due */
+		server->pace_tag =
+			g_timeout_add(server->cmd_queue_speed,
+				      (GSourceFunc) icb_sendq_pace, server);
+	} else if (server->sendq_spill != NULL && server->pace_tag == 0 &&
+		   server->flush_tag == 0) {
+		/* read more back once this is sent */
+		server->flush_tag =
+			g_idle_add_full(G_PRIORITY_DEFAULT,
+					(GSourceFunc) icb_sendq_flush_idle,
+					server, NULL);
+	}
+	return TRUE;
+}
+
+static int icb_sendq_flush_idle(ICB_SERVER_REC *server)
+{
+	server->flush_tag = 0;
+	icb_sendq_flush(server);
+	return FALSE;
+}
+
+static int icb_sendq_pace(ICB_SERVER_REC *server)
+{
+	server->pace_tag = 0;
+	icb_sendq_flush(server);
+	return FALSE;
+}
+
+/* Message text over the limit that isn't spilled */
+static void sendq_refuse(ICB_SERVER_REC *server, int len)
+{
+	server->sendq_dropped++;
+	server->sendq_dropped_bytes += len;
+
+	if (sendq_full_policy != SENDQ_FULL_DROP && !server->sendq_full) {
+		server->sendq_full = TRUE;
+		signal_emit("icb send queue full", 1, server);
+	}
+}
+
+/* TRUE if framed more bytes of message text are over the limit */
+static int sendq_over(ICB_SERVER_REC *server, int framed)
+{
+	return sendq_max_size > 0 &&
+		(server->sendq_spill != NULL ||
+		 icb_sendq_queued(server) + framed > sendq_max_size);
+}
+
+int icb_sendq_reserve(ICB_SERVER_REC *server, int framed)
+{
+	if (!sendq_over(server, framed) ||
+	    sendq_full_policy == SENDQ_FULL_SPILL)
+		return TRUE;
+
+	sendq_refuse(server, framed);
+	return FALSE;
+}
+
+/* Append the packet in data to queue, split into 256 byte blocks. Every
+   block but the last has a zero length byte. */
+static void sendq_frame(GString *queue, const unsigned char *data, int len)
+{
+	while (len > 255) {
+		g_string_append_c(queue, '\0');
+		g_string_append_len(queue, (const char *) data, 255);
+		data += 255;
+		len -= 255;
+	}
+
+	g_string_append_c(queue, len);
+	g_string_append_len(queue, (const char *) data, len);
+}
+
+int icb_sendq_add(ICB_SERVER_REC *server, int lane,
+		  const unsigned char *data, int len)
+{
+	GString *queue;
+	int start, queued, over, ret;
+
+	ICB_TRACE3(send__enqueue, server->tag, lane, len);
+	queue = server->sendq[lane];
+	start = queue->len;
+
+	/* framed size is one length byte per 255 bytes */
+	over = lane == ICB_SENDQ_BULK &&
+		sendq_over(server, len + 1 + (len - 1) / 255);
+	if (over && sendq_full_policy != SENDQ_FULL_SPILL) {
+		sendq_refuse(server, len);
+		return ICB_SENDQ_REFUSED;
+	}
+
+	sendq_frame(queue, data, len);
+	if (over) {
+		/* keep the order, everything after it is spilled too */
+		ret = sendq_spill_add(server, queue->str + start,
+				      queue->len - start);
+		g_string_truncate(queue, start);
+		if (!ret) {
+			sendq_refuse(server, len);
+			return ICB_SENDQ_REFUSED;
+		}
+	}
+
+	/* logged now, the flush may disconnect and free the server */
+	rawlog_output(server->rawlog, (const char *) data);
+	icb_stats_packet_out(server, data[0], len);
+	server->stats->blocks_out += (len - 1) / 255;
+	server->send_packets++;
+
+	queued = icb_sendq_queued(server);
+	if (queued > server->sendq_high)
+		server->sendq_high = queued;
+	icb_histogram_add(&server->stats->sendq_depth, queued);
+
+	if (lane != ICB_SENDQ_BULK) {
+		if (!icb_sendq_flush(server))
+			return ICB_SENDQ_LOST;
+	} else if (server->flush_tag == 0 && server->pace_tag == 0 &&
+		   server->write_tag == 0) {
+		/* default priority, so a busy socket can't starve it */
+		server->flush_tag =
+			g_idle_add_full(G_PRIORITY_DEFAULT,
+					(GSourceFunc) icb_sendq_flush_idle,
+					server, NULL);
+	}
+	return ICB_SENDQ_QUEUED;
+}
+
+int icb_sendq_length(ICB_SERVER_REC *server, int lane)
+{
+	return server->sendq[lane]->len - server->sendq_head[lane];
+}
+
+int icb_sendq_queued(ICB_SERVER_REC *server)
+{
+	int lane, queued;
+
+	queued = server->sendq_out->len;
+	for (lane = 0; lane < ICB_SENDQ_LANES; lane++)
+		queued += icb_sendq_length(server, lane);
+	return queued;
+}
+
+void icb_sendq_create(ICB_SERVER_REC *server)
+{
+	int lane;
+
+	for (lane = 0; lane < ICB_SENDQ_LANES; lane++)
+		server->sendq[lane] = g_string_sized_new(ICB_SENDQ_SIZE);
+	server->sendq_out = g_string_new(NULL);
+
+	server->sendq_tokens = server->max_cmds_at_once;
+	server->sendq_refilled = g_get_monotonic_time();
+}
+
+void icb_sendq_destroy(ICB_SERVER_REC *server)
+{
+	int lane;
+
+	for (lane = 0; lane < ICB_SENDQ_LANES; lane++) {
+		g_string_free(server->sendq[lane], TRUE);
+		server->sendq[lane] = NULL;
+	}
+	g_string_free(server->sendq_out, TRUE);
+	server->sendq_out = NULL;
+
+	if (server->sendq_spill != NULL)
+		sendq_spill_close(server);
+}
+
+static void sig_server_disconnected(ICB_SERVER_REC *server)
+{
+	if (!IS_ICB_SERVER(server))
+		return;
+
+	if (server->flush_tag != 0) {
+		g_source_remove(server->flush_tag);
+		server->flush_tag = 0;
+	}
+	if (server->pace_tag != 0) {
+		g_source_remove(server->pace_tag);
+		server->pace_tag = 0;
+	}
+	if (server->write_tag != 0) {
+		g_source_remove(server->write_tag);
+		server->write_tag = 0;
+	}
+}
+
+static void read_settings(void)
+{
+	const char *policy;
+
+	sendq_max_size = settings_get_size("icb_sendq_max_size");
+	policy = settings_get_str("icb_sendq_full");
+	if (g_ascii_strcasecmp(policy, "drop") == 0)
+		sendq_full_policy = SENDQ_FULL_DROP;
+	else if (g_ascii_strcasecmp(policy, "spill") == 0)
+		sendq_full_policy = SENDQ_FULL_SPILL;
+	else
+		sendq_full_policy = SENDQ_FULL_BLOCK;
+}
+
+void icb_sendq_init(void)
+{
+	settings_add_size("flood", "icb_sendq_max_size", "1M");
+	settings_add_str("flood", "icb_sendq_full", "block");
+
+	read_settings();
+	signal_add("setup changed", (SIGNAL_FUNC) read_settings);
+	signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
+
+void icb_sendq_deinit(void)
+{
+	signal_remove("setup changed", (SIGNAL_FUNC) read_settings);
+	signal_remove("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
+}
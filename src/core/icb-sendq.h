@@ -0,0 +1,40 @@
+#ifndef __ICB_SENDQ_H
+#define __ICB_SENDQ_H
+
+/* Initial size of the queues packets are gathered into between flushes */
+#define ICB_SENDQ_SIZE 1024
+
+/* icb_sendq_add() results */
+enum {
+	ICB_SENDQ_QUEUED,
+	ICB_SENDQ_REFUSED,	/* bulk packet over icb_sendq_max_size */
+	ICB_SENDQ_LOST		/* flushing it disconnected, server is gone */
+};
+
+/* Queue the nul-terminated packet in data on lane. Control and command
+   packets are flushed right away, bulk packets once per main loop
+   iteration. */
+int icb_sendq_add(ICB_SERVER_REC *server, int lane,
+		  const unsigned char *data, int len);
+
+/* Send what's allowed to be sent. Returns FALSE if the connection was
+   lost. */
+int icb_sendq_flush(ICB_SERVER_REC *server);
+
+/* Check that framed bytes of message text fit before queueing the first
+   of its packets, so a split message is sent whole or refused whole.
+   Returns FALSE if it was refused. */
+int icb_sendq_reserve(ICB_SERVER_REC *server, int framed);
+
+/* Number of bytes waiting in lane */
+int icb_sendq_length(ICB_SERVER_REC *server, int lane);
+/* Number of bytes waiting in memory, the spill file isn't counted */
+int icb_sendq_queued(ICB_SERVER_REC *server);
+
+void icb_sendq_create(ICB_SERVER_REC *server);
+void icb_sendq_destroy(ICB_SERVER_REC *server);
+
+void icb_sendq_init(void);
+void icb_sendq_deinit(void);
+
+#endif
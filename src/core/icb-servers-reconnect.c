@@ -34,6 +34,13 @@ static void sig_server_connect_copy(SERVER_CONNECT_REC **dest,
 
 	rec = g_new0(ICB_SERVER_CONNECT_REC, 1);
 	rec->chat_type = ICB_PROTOCOL;
+	rec->tcp_nodelay = src->tcp_nodelay;
+	rec->tcp_cork = src->tcp_cork;
+	rec->fast_connect = src->fast_connect;
+	rec->max_cmds_at_once = src->max_cmds_at_once;
+	rec->cmd_queue_speed = src->cmd_queue_speed;
+	rec->dead_peers = src->dead_peers;
+	rec->dead_peer_time = src->dead_peer_time;
 	*dest = (SERVER_CONNECT_REC *) rec;
 }
 
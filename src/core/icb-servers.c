@@ -20,6 +20,7 @@
 
 #include "module.h"
 #include "signals.h"
+#include "settings.h"
 #include "rawlog.h"
 #include "net-sendbuffer.h"
 
@@ -27,6 +28,8 @@
 #include "icb-servers.h"
 #include "icb-channels.h"
 #include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-stats.h"
 
 SERVER_REC *icb_server_init_connect(SERVER_CONNECT_REC *conn)
 {
@@ -41,8 +44,9 @@ SERVER_REC *icb_server_init_connect(SERVER_CONNECT_REC *conn)
 
 	server->silentwho = FALSE;
 	server->updatenicks = FALSE;
+	server->connect_started = g_get_monotonic_time();
 
-        server->recvbuf_size = 256;
+        server->recvbuf_size = ICB_RECVBUF_SIZE;
 	server->recvbuf = g_malloc(server->recvbuf_size);
 
         server->sendbuf_size = 256;
@@ -54,6 +58,17 @@ SERVER_REC *icb_server_init_connect(SERVER_CONNECT_REC *conn)
 	if (server->connrec->port <= 0)
 		server->connrec->port = 7326;
 
+	server->max_cmds_at_once = server->connrec->max_cmds_at_once > 0 ?
+		server->connrec->max_cmds_at_once :
+		settings_get_int("icb_cmds_max_at_once");
+	server->cmd_queue_speed = server->connrec->cmd_queue_speed > 0 ?
+		server->connrec->cmd_queue_speed :
+		settings_get_time("icb_cmd_queue_speed");
+	if (server->max_cmds_at_once <= 0)
+		server->max_cmds_at_once = 1;
+	icb_sendq_create(server);
+	icb_stats_create(server);
+
         server_connect_init((SERVER_REC *) server);
 	return (SERVER_REC *) server;
 }
@@ -81,6 +96,17 @@ static void sig_server_disconnected(ICB_SERVER_REC *server)
 
         g_free(server->recvbuf);
         g_free(server->sendbuf);
+	g_free_and_null(server->who_group);
+	if (server->who_output_tag != 0) {
+		g_source_remove(server->who_output_tag);
+		server->who_output_tag = 0;
+	}
+	if (server->who_output != NULL) {
+		g_string_free(server->who_output, TRUE);
+		server->who_output = NULL;
+	}
+	icb_sendq_destroy(server);
+	icb_stats_destroy(server);
 }
 
 char *icb_server_get_channels(ICB_SERVER_REC *server)
@@ -173,6 +199,9 @@ static void sig_setup_fill_connect(ICB_SERVER_CONNECT_REC *conn)
 
 void icb_servers_init(void)
 {
+	settings_add_int("flood", "icb_cmds_max_at_once", 10);
+	settings_add_time("flood", "icb_cmd_queue_speed", "200msecs");
+
 	signal_add_first("server connected", (SIGNAL_FUNC) sig_connected);
         signal_add("server disconnected", (SIGNAL_FUNC) sig_server_disconnected);
 	signal_add("server setup fill connect", (SIGNAL_FUNC) sig_setup_fill_connect);
@@ -20,6 +20,36 @@
 
 struct _ICB_SERVER_CONNECT_REC {
 #include "server-connect-rec.h"
+
+	unsigned int tcp_nodelay:1;
+	unsigned int tcp_cork:1;
+	unsigned int fast_connect:1;
+
+	int max_cmds_at_once;
+	int cmd_queue_speed;
+
+	/* kept over reconnects */
+	unsigned int dead_peers;	/* connections dropped for no pong */
+	gint64 dead_peer_time;	/* total usecs from last read to drop */
+};
+
+/* phases of setting up the connection, timed from its start */
+enum {
+	ICB_CONNECT_TCP,	/* TCP connection up */
+	ICB_CONNECT_PROTOCOL,	/* protocol packet received */
+	ICB_CONNECT_LOGIN,	/* login accepted */
+	ICB_CONNECT_SYNCED,	/* nicklist of the first group synced */
+
+	ICB_CONNECT_PHASES
+};
+
+/* send queue lanes, in priority order */
+enum {
+	ICB_SENDQ_CONTROL,	/* login, protocol, ping, pong, noop */
+	ICB_SENDQ_COMMAND,	/* commands */
+	ICB_SENDQ_BULK,		/* message text */
+
+	ICB_SENDQ_LANES
 };
 
 #define STRUCT_SERVER_CONNECT_REC ICB_SERVER_CONNECT_REC
@@ -31,12 +61,70 @@ struct _ICB_SERVER_REC {
 	unsigned char *sendbuf;
 	int sendbuf_size;
 
+	GString *sendq[ICB_SENDQ_LANES]; /* framed packets waiting to be sent */
+	int sendq_head[ICB_SENDQ_LANES]; /* first unsent byte */
+	unsigned long sendq_sent[ICB_SENDQ_LANES];
+	int flush_tag, pace_tag;
+
+	int max_cmds_at_once;	/* size of the token bucket */
+	int cmd_queue_speed;	/* msecs per token, 0 = no pacing */
+	int sendq_tokens;
+	gint64 sendq_refilled;	/* when the last token was added */
+
+	unsigned long send_flushes, send_packets;
+
+	GString *sendq_out;	/* written, but not yet taken by the socket */
+	int write_tag;		/* waiting for the socket to take sendq_out */
+	int sendq_high;		/* most bytes queued at once */
+	int sendq_full;		/* "icb send queue full" sent, not drained */
+	unsigned long sendq_dropped, sendq_dropped_bytes;
+	FILE *sendq_spill;	/* messages over icb_sendq_max_size, or NULL */
+	long sendq_spill_pos;	/* first byte not yet read back */
+	long sendq_spill_size;	/* bytes after it */
+	unsigned long sendq_spilled_bytes;
+
 	int silentwho;		/* silence /who output when updating nicks */
 	int updatenicks;	/* parse /who output for topic/nicks */
+	GString *who_output;	/* formatted /who lines not yet printed */
+	int who_output_tag;
 
 	unsigned char *recvbuf;
 	int recvbuf_size, recvbuf_pos;
-        int recvbuf_next_packet;
+	int recvbuf_start;	/* read cursor, first byte not yet parsed */
+
+	int parse_tag;		/* idle source continuing an over-budget read */
+	unsigned long read_wakeups;	/* times the socket became readable */
+	unsigned long read_deferred;	/* times the read budget ran out */
+	int read_max_backlog;	/* most bytes left unparsed after a wakeup */
+
+	ICB_CAPTURE_REC *capture; /* binary traffic capture, or NULL */
+	ICB_STATS_REC *stats;
+
+	gint64 connect_started;
+	gint64 connect_phase[ICB_CONNECT_PHASES]; /* usecs, 0 if not yet */
+	int login_sent;		/* login sent without waiting for the server */
+	char *who_group;	/* group of the nicklist /who in flight */
+
+	unsigned int lag_serial;
+	char *lag_id;		/* id of the lag ping waiting for its pong */
+	gint64 lag_ping_sent;
+	gint64 last_read;	/* when the socket was last readable */
+	ICB_HISTOGRAM_REC *lag_histogram; /* round trip times in usecs */
+
+	GQueue *requests;	/* ICB_REQUEST_RECs waiting for a reply */
+	void *request_active;	/* request the command output is for */
+	unsigned int request_serial;
+	unsigned long requests_done;
+	gint64 request_time;	/* total usecs from sending to reply */
+	ICB_DIRECTORY_REC *directory; /* users seen on the server */
+
+	GSList *group_cache;	/* recently left groups, newest first */
+	gint64 group_switched;	/* when we changed group, until it's synced */
+	int group_shown;	/* the nicklist of the new group is filled */
+	unsigned long group_switches, group_cache_hits;
+	unsigned long group_shows, group_syncs; /* switches timed below */
+	gint64 group_show_time;	/* total usecs from /g to a filled nicklist */
+	gint64 group_sync_time;	/* total usecs from /g to a synced nicklist */
 };
 
 SERVER_REC *icb_server_init_connect(SERVER_CONNECT_REC *conn);
@@ -0,0 +1,212 @@
+/*
+ icb-stats.c : irssi
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+
+#include "icb-servers.h"
+#include "icb-sendq.h"
+#include "icb-stats.h"
+
+void icb_stats_create(ICB_SERVER_REC *server)
+{
+	server->stats = g_new0(ICB_STATS_REC, 1);
+	server->stats->since = g_get_monotonic_time();
+}
+
+static void stats_free_handlers(ICB_STATS_REC *stats)
+{
+	int i;
+
+	for (i = 0; i < ICB_STATS_TYPES; i++)
+		g_free_and_null(stats->handler_time[i]);
+}
+
+void icb_stats_destroy(ICB_SERVER_REC *server)
+{
+	if (server->stats == NULL)
+		return;
+
+	stats_free_handlers(server->stats);
+	g_free_and_null(server->stats);
+}
+
+void icb_stats_reset(ICB_SERVER_REC *server)
+{
+	gint64 who_started;
+	int lane;
+
+	g_return_if_fail(server->stats != NULL);
+
+	who_started = server->stats->who_started;
+	stats_free_handlers(server->stats);
+	memset(server->stats, 0, sizeof(*server->stats));
+	server->stats->since = g_get_monotonic_time();
+	server->stats->who_started = who_started;
+
+	server->read_wakeups = 0;
+	server->read_deferred = 0;
+	server->read_max_backlog = 0;
+	server->send_packets = 0;
+	server->send_flushes = 0;
+	for (lane = 0; lane < ICB_SENDQ_LANES; lane++)
+		server->sendq_sent[lane] = 0;
+	server->sendq_high = icb_sendq_queued(server);
+	server->sendq_dropped = 0;
+	server->sendq_dropped_bytes = 0;
+	server->sendq_spilled_bytes = 0;
+
+	server->group_switches = 0;
+	server->group_cache_hits = 0;
+	server->group_shows = 0;
+	server->group_syncs = 0;
+	server->group_show_time = 0;
+	server->group_sync_time = 0;
+	server->requests_done = 0;
+	server->request_time = 0;
+}
+
+void icb_stats_packet_in(ICB_SERVER_REC *server, int type, int len)
+{
+	int i;
+
+	i = icb_stats_type(type);
+	if (server->stats == NULL || i < 0)
+		return;
+
+	server->stats->packets_in[i]++;
+	server->stats->bytes_in[i] += len;
+}
+
+void icb_stats_packet_time(ICB_SERVER_REC *server, int type,
+			   gint64 read_time, gint64 dispatch_time)
+{
+	ICB_STATS_REC *stats;
+	int i;
+
+	stats = server->stats;
+	icb_histogram_add(&stats->read_time, read_time);
+	icb_histogram_add(&stats->dispatch_time, dispatch_time);
+
+	i = icb_stats_type(type);
+	if (i < 0)
+		return;
+
+	if (stats->handler_time[i] == NULL)
+		stats->handler_time[i] = g_new0(ICB_HISTOGRAM_REC, 1);
+	icb_histogram_add(stats->handler_time[i], dispatch_time);
+}
+
+void icb_stats_packet_out(ICB_SERVER_REC *server, int type, int len)
+{
+	int i;
+
+	i = icb_stats_type(type);
+	if (server->stats == NULL || i < 0)
+		return;
+
+	server->stats->packets_out[i]++;
+	server->stats->bytes_out[i] += len;
+}
+
+static void stats_sum(const unsigned long *counts, unsigned long *total)
+{
+	int i;
+
+	*total = 0;
+	for (i = 0; i < ICB_STATS_TYPES; i++)
+		*total += counts[i];
+}
+
+static void append_histogram(GString *str, const char *name,
+			     const ICB_HISTOGRAM_REC *hist)
+{
+	g_string_append_printf(str, " %s_count=%lu %s_p50=%lu %s_p99=%lu "
+				"%s_max=%lu", name, hist->count,
+				name, (unsigned long)
+				icb_histogram_percentile(hist, 50),
+				name, (unsigned long)
+				icb_histogram_percentile(hist, 99),
+				name, (unsigned long) hist->max);
+}
+
+char *icb_stats_get(ICB_SERVER_REC *server)
+{
+	ICB_STATS_REC *stats;
+	GString *str;
+	unsigned long packets, bytes;
+	char name[20];
+	int i;
+
+	g_return_val_if_fail(server->stats != NULL, NULL);
+	stats = server->stats;
+
+	str = g_string_new(NULL);
+	g_string_append_printf(str, "seconds=%lu",
+			       (unsigned long) ((g_get_monotonic_time() -
+						 stats->since) / 1000000));
+
+	stats_sum(stats->packets_in, &packets);
+	stats_sum(stats->bytes_in, &bytes);
+	g_string_append_printf(str, " packets_in=%lu bytes_in=%lu "
+			       "blocks_in=%lu", packets, bytes,
+			       stats->blocks_in);
+	stats_sum(stats->packets_out, &packets);
+	stats_sum(stats->bytes_out, &bytes);
+	g_string_append_printf(str, " packets_out=%lu bytes_out=%lu "
+			       "blocks_out=%lu", packets, bytes,
+			       stats->blocks_out);
+
+	for (i = 0; i < ICB_STATS_TYPES; i++) {
+		if (stats->packets_in[i] > 0) {
+			g_string_append_printf(str, " in_%c=%lu in_%c_bytes=%lu",
+					       'a' + i, stats->packets_in[i],
+					       'a' + i, stats->bytes_in[i]);
+		}
+		if (stats->packets_out[i] > 0) {
+			g_string_append_printf(str,
+					       " out_%c=%lu out_%c_bytes=%lu",
+					       'a' + i, stats->packets_out[i],
+					       'a' + i, stats->bytes_out[i]);
+		}
+	}
+
+	g_string_append_printf(str, " read_wakeups=%lu read_deferred=%lu "
+			       "socket_reads=%lu", server->read_wakeups,
+			       server->read_deferred, stats->socket_reads);
+	append_histogram(str, "wakeup_packets", &stats->wakeup_packets);
+	append_histogram(str, "read_usecs", &stats->read_time);
+	append_histogram(str, "dispatch_usecs", &stats->dispatch_time);
+	for (i = 0; i < ICB_STATS_TYPES; i++) {
+		if (stats->handler_time[i] == NULL)
+			continue;
+		g_snprintf(name, sizeof(name), "handler_%c_usecs", 'a' + i);
+		append_histogram(str, name, stats->handler_time[i]);
+	}
+	g_string_append_printf(str, " sendq_queued=%d sendq_high=%d "
+			       "sendq_dropped=%lu sendq_dropped_bytes=%lu "
+			       "sendq_spilled_bytes=%lu sendq_spill=%ld",
+			       icb_sendq_queued(server), server->sendq_high,
+			       server->sendq_dropped,
+			       server->sendq_dropped_bytes,
+			       server->sendq_spilled_bytes,
+			       server->sendq_spill_size);
+	append_histogram(str, "sendq_bytes", &stats->sendq_depth);
+	append_histogram(str, "who_sync_usecs", &stats->who_sync);
+
+	return g_string_free(str, FALSE);
+}
@@ -0,0 +1,57 @@
+#ifndef __ICB_STATS_H
+#define __ICB_STATS_H
+
+#include "icb-histogram.h"
+
+/*
+ * Performance counters of a server. The times are in usecs, and only
+ * one in ICB_STATS_SAMPLE packets is timed since reading the clock costs
+ * about as much as handling a small packet. The older counters kept in
+ * the server record itself (read wakeups, send queue, group switches,
+ * requests) are reset together with these.
+ */
+#define ICB_STATS_TYPES 26	/* packet types 'a' to 'z' */
+#define ICB_STATS_SAMPLE 64	/* power of two */
+
+struct _ICB_STATS_REC {
+	gint64 since;		/* when the counters were last reset */
+
+	unsigned long packets_in[ICB_STATS_TYPES], bytes_in[ICB_STATS_TYPES];
+	unsigned long packets_out[ICB_STATS_TYPES], bytes_out[ICB_STATS_TYPES];
+	unsigned long blocks_in, blocks_out; /* 256 byte continuation blocks */
+	unsigned long socket_reads;
+
+	ICB_HISTOGRAM_REC wakeup_packets; /* packets handled per wakeup */
+	ICB_HISTOGRAM_REC read_time;	/* reading and framing a packet */
+	ICB_HISTOGRAM_REC dispatch_time; /* parsing and handling a packet */
+	ICB_HISTOGRAM_REC *handler_time[ICB_STATS_TYPES]; /* or NULL */
+
+	ICB_HISTOGRAM_REC sendq_depth;	/* bytes queued after adding one */
+	ICB_HISTOGRAM_REC who_sync;	/* from the nicklist /who to synced */
+	gint64 who_started;	/* kept over resets, a /who may be running */
+
+	unsigned int sample_count;
+};
+
+#define icb_stats_type(type) \
+	((type) >= 'a' && (type) <= 'z' ? (type) - 'a' : -1)
+
+/* TRUE if the next packet should be timed */
+#define icb_stats_sample(server) \
+	(((server)->stats->sample_count++ & (ICB_STATS_SAMPLE - 1)) == 0)
+
+void icb_stats_create(ICB_SERVER_REC *server);
+void icb_stats_destroy(ICB_SERVER_REC *server);
+void icb_stats_reset(ICB_SERVER_REC *server);
+
+void icb_stats_packet_in(ICB_SERVER_REC *server, int type, int len);
+void icb_stats_packet_out(ICB_SERVER_REC *server, int type, int len);
+
+/* A sampled packet was read in read_time and handled in dispatch_time */
+void icb_stats_packet_time(ICB_SERVER_REC *server, int type,
+			   gint64 read_time, gint64 dispatch_time);
+
+/* The counters as "name=value" pairs separated by spaces, for scripts */
+char *icb_stats_get(ICB_SERVER_REC *server);
+
+#endif
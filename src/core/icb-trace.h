@@ -0,0 +1,35 @@
+#ifndef __ICB_TRACE_H
+#define __ICB_TRACE_H
+
+/*
+ * USDT probes for perf, bpftrace and SystemTap, added with
+ * ./configure --enable-usdt. Each one is a single nop in the code until
+ * a tracer attaches to it, and nothing at all without the switch.
+ *
+ *   packet__framed(len, blocks)          a packet was read and framed
+ *   packet__dispatch(tag, type, len)     before the packet is handled
+ *   handler__entry(tag, type, category)  before the handlers of a packet,
+ *   handler__return(tag, type, category) and after them; category is the
+ *                                        cmdout or status name, or ""
+ *   send__enqueue(tag, lane, len)        a packet was queued
+ *   send__flush(tag, len)                queued data was written
+ *   who__sync__begin(group)
+ *   who__sync__end(group, added, removed)
+ *   connect__phase(tag, phase, usecs)    ICB_CONNECT_* reached
+ *
+ * List them with: perf list 'sdt_irssi_icb:*' after perf buildid-cache
+ * --add, or bpftrace -l 'usdt:/path/libicb_core.so:*'
+ */
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define ICB_TRACE1(name, a) DTRACE_PROBE1(irssi_icb, name, a)
+#define ICB_TRACE2(name, a, b) DTRACE_PROBE2(irssi_icb, name, a, b)
+#define ICB_TRACE3(name, a, b, c) DTRACE_PROBE3(irssi_icb, name, a, b, c)
+#else
+#define ICB_TRACE1(name, a)
+#define ICB_TRACE2(name, a, b)
+#define ICB_TRACE3(name, a, b, c)
+#endif
+
+#endif
@@ -3,13 +3,48 @@
 
 #define DEFAULT_ICB_GROUP "1" /* default group to join if none is specified */
 
+typedef struct _ICB_CHATNET_REC ICB_CHATNET_REC;
 typedef struct _ICB_SERVER_CONNECT_REC ICB_SERVER_CONNECT_REC;
 typedef struct _ICB_SERVER_REC ICB_SERVER_REC;
 typedef struct _ICB_CHANNEL_REC ICB_CHANNEL_REC;
+typedef struct _ICB_CAPTURE_REC ICB_CAPTURE_REC;
+typedef struct _ICB_DIRECTORY_REC ICB_DIRECTORY_REC;
+typedef struct _ICB_HISTOGRAM_REC ICB_HISTOGRAM_REC;
+typedef struct _ICB_STATS_REC ICB_STATS_REC;
 
 #define ICB_PROTOCOL (chat_protocol_lookup("ICB"))
 
-char **icb_split(const char *data, int count);
-void icb_split_free(char **args);
+/* Fields after the last one are left unsplit in the last field */
+#define ICB_PACKET_MAX_FIELDS 16
+
+/* Large enough for any single word of a packet that is needed as a
+   separate string, eg. nick of a status message */
+#define ICB_WORD_BUFSIZE 256
+
+/* A received packet, split into ^A separated fields. The fields point
+   directly into the receive buffer and are valid only while the packet
+   is being handled. */
+typedef struct {
+	char type;
+	int count;
+	char *fields[ICB_PACKET_MAX_FIELDS+1]; /* NULL terminated */
+	int lengths[ICB_PACKET_MAX_FIELDS];
+} ICB_PACKET_REC;
+
+/* A user line of a who listing. The strings point into the packet, the
+   times are left unconverted until something needs them. */
+typedef struct {
+	char mod;		/* '*' or 'm' for moderator, ' ' if not */
+	const char *nick;
+	const char *idle;	/* seconds idle */
+	const char *login;	/* login time, time_t */
+	const char *user;
+	const char *host;
+	const char *status;	/* registration status */
+} ICB_WHO_REC;
+
+void icb_packet_parse(ICB_PACKET_REC *packet, char *data, int len);
+int icb_who_parse(ICB_WHO_REC *who, const ICB_PACKET_REC *packet);
+char *icb_get_word(const char *str, char *buf, size_t size);
 
 #endif
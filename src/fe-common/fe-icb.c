@@ -29,13 +29,19 @@
 #include "nicklist.h"
 
 #include "icb.h"
+#include "icb-commands.h"
 #include "icb-servers.h"
 #include "icb-channels.h"
 #include "icb-nicklist.h"
 #include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-directory.h"
+#include "icb-request.h"
+#include "icb-stats.h"
 
 #include "printtext.h"
 #include "themes.h"
+#include "fe-windows.h"
 
 static void icb_change_topic(ICB_SERVER_REC *server, const char *topic,
 			     const char *setby, time_t settime)
@@ -69,59 +75,116 @@ static void icb_change_topic(ICB_SERVER_REC *server, const char *topic,
  *
  * So for now we don't bother to track the moderator, just the group nicks
  */
-static void icb_update_nicklist(ICB_SERVER_REC *server)
+/* End of the silent /who of group, the front-end displays the /names
+   list once the nicklist is synced */
+static void icb_update_nicklist_done(ICB_SERVER_REC *server,
+				     const char *group)
+{
+	server->silentwho = FALSE;
+	server->updatenicks = FALSE;
+
+	/* changed group meanwhile, its own /who ends the sync */
+	if (g_ascii_strcasecmp(group, server->group->name) != 0)
+		return;
+
+	if (server->group->sync_nicks == NULL) {
+		/* our group wasn't listed */
+		signal_emit("channel joined", 1, server->group);
+		return;
+	}
+	icb_nicklist_sync_end(server->group);
+}
+
+static void sig_nicklist_synced(ICB_CHANNEL_REC *channel)
+{
+	signal_emit("channel joined", 1, channel);
+}
+
+/* The lines themselves are parsed by cmdout_co and cmdout_wl */
+static void update_nicklist_reply(ICB_SERVER_REC *server,
+				  ICB_PACKET_REC *packet, char *group)
+{
+	if (packet != NULL) {
+		server->silentwho = TRUE;
+		return;
+	}
+
+	/* unless a /who of another group was sent after it */
+	if (server->who_group != NULL &&
+	    g_ascii_strcasecmp(server->who_group, group) == 0)
+		g_free_and_null(server->who_group);
+	icb_directory_listing_end(server);
+	if (!server->disconnected) {
+		icb_histogram_add(&server->stats->who_sync,
+				  g_get_monotonic_time() -
+				  server->stats->who_started);
+		icb_update_nicklist_done(server, group);
+	}
+}
+
+static void icb_update_nicklist(ICB_SERVER_REC *server, const char *group)
 {
 	/*
-	 * In theory we should be able to just send '/who <group>' and parse,
-	 * but the problem is that ICB does not send any kind of end-of-who
-	 * marker when only listing one group, and sending a separate command
-	 * isn't guaranteed to come back in the right order.
-	 *
-	 * So we're forced do perform a full /who and then match against our
-	 * groupname.  A full /who is terminated with a 'Total: ' line which we
-	 * can use as EOF>
+	 * ICB does not send any kind of end-of-who marker when only listing
+	 * one group, so let the request mark the end of the list.
 	 */
-	server->silentwho = TRUE;
-	icb_command(server, "w", "", NULL);
+	g_free(server->who_group);
+	server->who_group = g_strdup(group);
+	server->stats->who_started = g_get_monotonic_time();
+	icb_request(server, "w", group,
+		    (ICB_REQUEST_FUNC) update_nicklist_reply,
+		    g_strdup(group), g_free);
 }
 
-static void event_error(ICB_SERVER_REC *server, const char *data)
+/* With a fast connect the /who of the group goes out with the login */
+static void sig_server_connected(ICB_SERVER_REC *server)
 {
-	printformat(server, NULL, MSGLEVEL_CRAP, ICBTXT_ERROR, data);
+	if (!IS_ICB_SERVER(server) || !server->login_sent)
+		return;
+
+	icb_update_nicklist(server, server->connrec->channels);
 }
 
-static void event_important(ICB_SERVER_REC *server, const char *data)
+static void event_error(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	char **args;
+	printformat(server, NULL, MSGLEVEL_CRAP, ICBTXT_ERROR,
+		    packet->fields[0]);
+}
 
-	args = icb_split(data, 2);
+static void event_important(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
 	printformat(server, NULL, MSGLEVEL_CRAP, ICBTXT_IMPORTANT,
-		    args[0], args[1]);
-        icb_split_free(args);
+		    packet->fields[0], packet->fields[1]);
 }
 
-static void event_beep(ICB_SERVER_REC *server, const char *data)
+static void event_beep(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	printformat(server, data, MSGLEVEL_CRAP, ICBTXT_BEEP, data);
+	printformat(server, packet->fields[0], MSGLEVEL_CRAP, ICBTXT_BEEP,
+		    packet->fields[0]);
 }
 
-static void event_open(ICB_SERVER_REC *server, const char *data)
+static void sig_sendq_full(ICB_SERVER_REC *server)
 {
-	char **args;
+	printformat(server, NULL, MSGLEVEL_CLIENTERROR, ICBTXT_SENDQ_FULL,
+		    server->tag, icb_sendq_queued(server));
+}
 
-	args = icb_split(data, 2);
-	signal_emit("message public", 5, server, args[1], args[0], "",
-		    server->group->name);
-        icb_split_free(args);
+static void sig_sendq_drained(ICB_SERVER_REC *server)
+{
+	printformat(server, NULL, MSGLEVEL_CLIENTNOTICE, ICBTXT_SENDQ_DRAINED,
+		    server->tag);
 }
 
-static void event_personal(ICB_SERVER_REC *server, const char *data)
+static void event_open(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	char **args;
+	signal_emit("message public", 5, server, packet->fields[1],
+		    packet->fields[0], "", server->group->name);
+}
 
-	args = icb_split(data, 2);
-	signal_emit("message private", 4, server, args[1], args[0], "");
-        icb_split_free(args);
+static void event_personal(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	signal_emit("message private", 4, server, packet->fields[1],
+		    packet->fields[0], "");
 }
 
 static void idle_time(char *buf, size_t bufsize, time_t idle)
@@ -147,9 +210,68 @@ static void idle_time(char *buf, size_t bufsize, time_t idle)
 		snprintf(buf, bufsize, "   %2ds", (int)idle);
 }
 
-static void cmdout_co(ICB_SERVER_REC *server, char **args)
+/* Print the /who lines collected so far in one go */
+static void who_output_flush(ICB_SERVER_REC *server)
+{
+	if (server->who_output_tag != 0) {
+		g_source_remove(server->who_output_tag);
+		server->who_output_tag = 0;
+	}
+	if (server->who_output == NULL || server->who_output->len == 0)
+		return;
+
+	/* drop the last newline, the rest split the lines */
+	g_string_truncate(server->who_output, server->who_output->len-1);
+	printtext(server, NULL, MSGLEVEL_CRAP, "%s", server->who_output->str);
+	g_string_truncate(server->who_output, 0);
+}
+
+static int who_output_idle(ICB_SERVER_REC *server)
 {
-	char *p, *group, *topic;
+	server->who_output_tag = 0;
+	who_output_flush(server);
+	return FALSE;
+}
+
+/* Flush before anything else gets printed, so the order is kept */
+static void sig_who_output_flush(ICB_SERVER_REC *server)
+{
+	if (IS_ICB_SERVER(server))
+		who_output_flush(server);
+}
+
+static void who_output_add(ICB_SERVER_REC *server, const ICB_WHO_REC *who)
+{
+	struct tm *logintime;
+	char logbuf[20];
+	char idlebuf[20];
+	time_t temptime;
+
+	temptime = strtol(who->login, NULL, 10);
+	logintime = gmtime(&temptime);
+	strftime(logbuf, sizeof(logbuf), "%b %e %H:%M", logintime);
+	temptime = strtol(who->idle, NULL, 10);
+	idle_time(idlebuf, sizeof(idlebuf), temptime);
+
+	if (server->who_output == NULL)
+		server->who_output = g_string_sized_new(1024);
+	g_string_append_printf(server->who_output,
+			       "*** %c%-14.14s %6.6s %12.12s %s@%s %s\n",
+			       who->mod == ' ' ? ' ' : '*', who->nick,
+			       idlebuf, logbuf, who->user, who->host,
+			       who->status);
+
+	/* the rest of the listing is likely in the same read */
+	if (server->who_output_tag == 0) {
+		server->who_output_tag =
+			g_idle_add((GSourceFunc) who_output_idle, server);
+	}
+}
+
+static void cmdout_co(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
+{
+	char group[ICB_WORD_BUFSIZE];
+	char *line, *p, *topic;
 	int len;
 
 	static const char match_group[] = "Group: ";
@@ -163,17 +285,18 @@ static void cmdout_co(ICB_SERVER_REC *server, char **args)
 	 * reset the nick updates
 	 */
 	server->updatenicks = FALSE;
+	line = packet->fields[1];
+	if (line == NULL)
+		return;
 
 	/* If we're running in silent mode, parse the output for nicks/topic */
 	if (server->silentwho) {
 
 		/* Match group lines */
 		len = strlen(match_group);
-		if (strncmp(args[0], match_group, len) == 0) {
+		if (strncmp(line, match_group, len) == 0) {
 
-			group = g_strdup(args[0] + len);
-			p = strchr(group, ' ');
-			*p = '\0';
+			icb_get_word(line + len, group, sizeof(group));
 
 			/* Check for our particular group */
 			len = strlen(group);
@@ -181,9 +304,10 @@ static void cmdout_co(ICB_SERVER_REC *server, char **args)
 
 				/* Start matching nicks */
 				server->updatenicks = TRUE;
+				icb_nicklist_sync_begin(server->group);
 
-				p = strstr(args[0], match_topic);
-				if (p != NULL && p != args[0]) {
+				p = strstr(line, match_topic);
+				if (p != NULL && p != line) {
 					topic = p + strlen(match_topic);
 					if (topic != NULL) {
 						len = strlen(match_topicunset);
@@ -197,81 +321,61 @@ static void cmdout_co(ICB_SERVER_REC *server, char **args)
 					}
 				}
 			}
-			g_free(group);
 		}
 
 		/*
-		 * End of /who output, stop silent mode and signal front-end
-		 * to display /names list
+		 * End of a full /who output. A group /who is ended by its
+		 * request instead.
 		 */
 		len = strlen(match_total);
-		if (strncmp(args[0], match_total, len) == 0) {
-			server->silentwho = FALSE;
-			signal_emit("channel joined", 1, server->group);
-		}
+		if (strncmp(line, match_total, len) == 0 &&
+		    server->request_active == NULL)
+			icb_update_nicklist_done(server, server->group->name);
 	} else {
+		who_output_flush(server);
+
 		/* Now that /topic works correctly, ignore server output */
 		len = strlen(match_topicis);
-		if (strncmp(args[0], match_topicis, len) != 0) {
-			printtext(server, NULL, MSGLEVEL_CRAP, "%s", args[0]);
+		if (strncmp(line, match_topicis, len) != 0) {
+			printtext(server, NULL, MSGLEVEL_CRAP, "%s", line);
 		}
 	}
 }
 
-static void cmdout_wl(ICB_SERVER_REC *server, char **args)
+static void cmdout_wl(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	struct tm *logintime;
-	char logbuf[20];
-	char idlebuf[20];
-	char line[255];
-	time_t temptime;
+	ICB_WHO_REC who;
 	int op;
 
-	/* "wl" : In a who listing, a line of output listing a user. Has the following format:
-
-	* Field 1: String indicating whether user is moderator or not. Usually "*" for
-	* moderator, and " " for not.
-	* Field 2: Nickname of user.
-	* Field 3: Number of seconds user has been idle.
-	* Field 4: Response Time. No longer in use.
-	* Field 5: Login Time. Unix time_t format. Seconds since Jan. 1, 1970 GMT.
-	* Field 6: Username of user.
-	* Field 7: Hostname of user.
-	* Field 8: Registration status.
-	*/
-	temptime = strtol(args[4], NULL, 10);
-	logintime = gmtime(&temptime);
-	strftime(logbuf, sizeof(logbuf), "%b %e %H:%M", logintime);
-	temptime = strtol(args[2], NULL, 10);
-	idle_time(idlebuf, sizeof(idlebuf), temptime);
+	if (!icb_who_parse(&who, packet))
+		return;
 
 	/* Update nicklist */
 	if (server->updatenicks) {
 		op = FALSE;
 #ifdef NO_MOD_SUPPORT_YET
-		switch(args[0][0]) {
+		switch(who.mod) {
 		case '*':
 		case 'm':
 			op = TRUE;
 			break;
 		}
 #endif
-		icb_nicklist_insert(server->group, args[1], op);
-	}
-	if (!server->silentwho) {
-		snprintf(line, sizeof(line), "*** %c%-14.14s %6.6s %12.12s %s@%s %s",
-			  args[0][0] == ' '?' ':'*', args[1], idlebuf, logbuf, args[5],
-			  args[6], args[7]);
-		printtext(server, NULL, MSGLEVEL_CRAP, line);
+		icb_nicklist_sync_add(server->group, who.nick, op);
 	}
+
+	/* Only format what is going to be printed */
+	if (!server->silentwho)
+		who_output_add(server, &who);
 }
 
-static void cmdout_default(ICB_SERVER_REC *server, char **args)
+static void cmdout_default(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
 	char *data;
 
-	data = g_strjoinv(" ", args+1);
+	data = g_strjoinv(" ", packet->fields+1);
 	if (!server->silentwho) {
+		who_output_flush(server);
 		printtext(server, NULL, MSGLEVEL_CRAP, "%s", data);
 	}
         g_free(data);
@@ -279,18 +383,20 @@ static void cmdout_default(ICB_SERVER_REC *server, char **args)
 
 /*
  * args0 = "Arrive"
- * args0 = "<nickname> (<user>@<host>) entered group"
+ * args1 = "<nickname> (<user>@<host>) entered group"
  */
-static void status_arrive(ICB_SERVER_REC *server, char **args)
+static void status_arrive(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	char *nick, *p;
+	char **args = packet->fields;
+	char nick[ICB_WORD_BUFSIZE];
+
+	if (args[1] == NULL)
+		return;
 
-	nick = g_strdup(args[1]);
-	p = strchr(nick, ' ');
-	*p = '\0';
 	/* XXX: new arrivals can still be moderator */
+	icb_get_word(args[1], nick, sizeof(nick));
 	icb_nicklist_insert(server->group, nick, FALSE);
-        g_free(nick);
+	icb_nicklist_sync_add(server->group, nick, FALSE);
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
 		    ICBTXT_STATUS, args[0], args[1]);
@@ -300,20 +406,21 @@ static void status_arrive(ICB_SERVER_REC *server, char **args)
  * args0 = "Depart"
  * args1 = "<nickname> (<user>@<host>) just left"
  */
-static void status_depart(ICB_SERVER_REC *server, char **args)
+static void status_depart(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
+	char **args = packet->fields;
+	char nick[ICB_WORD_BUFSIZE];
 	NICK_REC *nickrec;
-	char *nick, *p;
 
-	nick = g_strdup(args[1]);
-	p = strchr(nick, ' ');
-	*p = '\0';
+	if (args[1] == NULL)
+		return;
 
+	icb_get_word(args[1], nick, sizeof(nick));
 	nickrec = nicklist_find(CHANNEL(server->group), nick);
 	if (nickrec != NULL) {
 		nicklist_remove(CHANNEL(server->group), nickrec);
 	}
-	g_free(nick);
+	icb_nicklist_sync_remove(server->group, nick);
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
 		    ICBTXT_STATUS, args[0], args[1]);
@@ -323,17 +430,17 @@ static void status_depart(ICB_SERVER_REC *server, char **args)
  * args0 = "Sign-on"
  * args1 = "<nickname> (<user>@<host>) entered group"
  */
-static void status_signon(ICB_SERVER_REC *server, char **args)
+static void status_signon(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	char *nick, *p;
+	char **args = packet->fields;
+	char nick[ICB_WORD_BUFSIZE];
 
-	nick = g_strdup(args[1]);
-	p = strchr(nick, ' ');
-	*p = '\0';
+	if (args[1] == NULL)
+		return;
 
+	icb_get_word(args[1], nick, sizeof(nick));
 	icb_nicklist_insert(server->group, nick, FALSE);
-
-        g_free(nick);
+	icb_nicklist_sync_add(server->group, nick, FALSE);
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
 		    ICBTXT_STATUS, args[0], args[1]);
@@ -343,20 +450,21 @@ static void status_signon(ICB_SERVER_REC *server, char **args)
  * args0 = "Sign-off"
  * args1 = "<nickname> (<user>@<host>) has signed off."
  */
-static void status_signoff(ICB_SERVER_REC *server, char **args)
+static void status_signoff(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
+	char **args = packet->fields;
+	char nick[ICB_WORD_BUFSIZE];
 	NICK_REC *nickrec;
-	char *nick, *p;
 
-	nick = g_strdup(args[1]);
-	p = strchr(nick, ' ');
-	*p = '\0';
+	if (args[1] == NULL)
+		return;
 
+	icb_get_word(args[1], nick, sizeof(nick));
 	nickrec = nicklist_find(CHANNEL(server->group), nick);
 	if (nickrec != NULL) {
 		nicklist_remove(CHANNEL(server->group), nickrec);
 	}
-	g_free(nick);
+	icb_nicklist_sync_remove(server->group, nick);
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
 		    ICBTXT_STATUS, args[0], args[1]);
@@ -368,9 +476,14 @@ static void status_signoff(ICB_SERVER_REC *server, char **args)
  * args0 = "Status"
  * args0 = "You are now in group <group>[ as moderator]"
  */
-static void status_join(ICB_SERVER_REC *server, char **args)
+static void status_join(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	icb_update_nicklist(server);
+	char **args = packet->fields;
+
+	/* unless it was already asked for while connecting */
+	if (server->who_group == NULL ||
+	    g_ascii_strcasecmp(server->who_group, server->group->name) != 0)
+		icb_update_nicklist(server, server->group->name);
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
 		    ICBTXT_STATUS, args[0], args[1]);
@@ -380,33 +493,34 @@ static void status_join(ICB_SERVER_REC *server, char **args)
  * args0 = "Name"
  * args1 = "<oldnick> changed nickname to <newnick>"
  */
-static void status_name(ICB_SERVER_REC *server, char **args)
+static void status_name(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
+	char **args = packet->fields;
+	char oldnick[ICB_WORD_BUFSIZE];
+	const char *newnick;
 	NICK_REC *nickrec;
-	char *oldnick, *newnick, *p;
-
-	oldnick = g_strdup(args[1]);
-	p = strchr(oldnick, ' ');
-	if (p != NULL) *p = '\0';
-
-	p = g_strdup(args[1]);
-	newnick = strrchr(p, ' ');
-	if (newnick != NULL)
-	       newnick++;
-
-	nickrec = nicklist_find(CHANNEL(server->group), oldnick);
-	if (nickrec != NULL)
-		nicklist_rename(SERVER(server), oldnick, newnick);
-
-	/* Update our own nick */
-	if (strcmp(oldnick, server->connrec->nick) == 0) {
-		server_change_nick(SERVER(server), newnick);
-		g_free(server->connrec->nick);
-		server->connrec->nick = g_strdup(newnick);
-	}
 
-	g_free(oldnick);
-	g_free(p);
+	if (args[1] == NULL)
+		return;
+
+	icb_get_word(args[1], oldnick, sizeof(oldnick));
+
+	newnick = strrchr(args[1], ' ');
+	if (newnick != NULL) {
+		newnick++;
+
+		nickrec = nicklist_find(CHANNEL(server->group), oldnick);
+		if (nickrec != NULL)
+			nicklist_rename(SERVER(server), oldnick, newnick);
+		icb_nicklist_sync_rename(server->group, oldnick, newnick);
+
+		/* Update our own nick */
+		if (strcmp(oldnick, server->connrec->nick) == 0) {
+			server_change_nick(SERVER(server), newnick);
+			g_free(server->connrec->nick);
+			server->connrec->nick = g_strdup(newnick);
+		}
+	}
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
 		    ICBTXT_STATUS, args[0], args[1]);
@@ -416,26 +530,29 @@ static void status_name(ICB_SERVER_REC *server, char **args)
  * args0 = "Topic"
  * args1 = "<nickname> changed the topic to "<topic>"
  */
-static void status_topic(ICB_SERVER_REC *server, char **args)
+static void status_topic(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
-	char *topic, *setby, *p1, *p2;
+	char **args = packet->fields;
+	char setby[ICB_WORD_BUFSIZE];
+	char *topic, *end;
 
-	p1 = strchr(args[1], '"');
-	p2 = strrchr(args[1], '"');
+	if (args[1] == NULL)
+		return;
 
-	if (p1++) {
-		topic = g_strdup(p1);
-		p2 = strrchr(topic, '"');
-		*p2 = '\0';
+	topic = strchr(args[1], '"');
+	end = strrchr(args[1], '"');
 
-		setby = g_strdup(args[1]);
-		p2 = strchr(setby, ' ');
-		*p2 = '\0';
+	if (topic++ != NULL) {
+		/* cut the closing quote only for the duration of the
+		   topic change, the whole line is printed below */
+		if (end >= topic)
+			*end = '\0';
 
+		icb_get_word(args[1], setby, sizeof(setby));
 		icb_change_topic(server, topic, setby, time(NULL));
 
-		g_free(topic);
-		g_free(setby);
+		if (end >= topic)
+			*end = '"';
 	}
 
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
@@ -452,21 +569,426 @@ static void status_topic(ICB_SERVER_REC *server, char **args)
  * args1 is used.
  *
  */
-static void status_pass(ICB_SERVER_REC *server, char **args)
+static void status_pass(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
 	/*
 	 * Eventually we might want to track this, for now just print status
 	 * to the group window
 	 */
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
-		    ICBTXT_STATUS, args[0], args[1]);
+		    ICBTXT_STATUS, packet->fields[0], packet->fields[1]);
 }
 
-static void status_default(ICB_SERVER_REC *server, char **args)
+static void status_default(ICB_SERVER_REC *server, ICB_PACKET_REC *packet)
 {
 	/* Send messages to the group window by default */
 	printformat(server, server->group->name, MSGLEVEL_CRAP,
-		    ICBTXT_STATUS, args[0], args[1]);
+		    ICBTXT_STATUS, packet->fields[0], packet->fields[1]);
+}
+
+static void print_stat(ICB_SERVER_REC *server, const char *name,
+		       const char *fmt, ...)
+{
+	va_list va;
+	char *value;
+
+	va_start(va, fmt);
+	value = g_strdup_vprintf(fmt, va);
+	va_end(va);
+
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_STATS,
+		    name, value);
+	g_free(value);
+}
+
+/* The time each connect phase was reached, in ms from the start */
+static void print_connect_stats(ICB_SERVER_REC *server)
+{
+	static const char *names[ICB_CONNECT_PHASES] = {
+		"tcp", "protocol", "login", "synced"
+	};
+	GString *str;
+	int i;
+
+	str = g_string_new(server->login_sent ? "fast," : "normal,");
+	for (i = 0; i < ICB_CONNECT_PHASES; i++) {
+		if (server->connect_phase[i] == 0)
+			g_string_append_printf(str, " %s -", names[i]);
+		else {
+			g_string_append_printf(str, " %s %.1f", names[i],
+					       server->connect_phase[i] /
+					       1000.0);
+		}
+	}
+	print_stat(server, "Connect (ms)", "%s", str->str);
+	g_string_free(str, TRUE);
+}
+
+static void print_histogram(ICB_SERVER_REC *server, const char *name,
+			    const ICB_HISTOGRAM_REC *hist, const char *unit)
+{
+	print_stat(server, name, "%lu %s p50, %lu %s p99, %lu %s max",
+		   (unsigned long) icb_histogram_percentile(hist, 50), unit,
+		   (unsigned long) icb_histogram_percentile(hist, 99), unit,
+		   (unsigned long) hist->max, unit);
+}
+
+static void print_packet_stats(ICB_SERVER_REC *server)
+{
+	ICB_STATS_REC *stats;
+	unsigned long packets_in, bytes_in, packets_out, bytes_out;
+	char name[20];
+	int i;
+
+	stats = server->stats;
+	packets_in = bytes_in = packets_out = bytes_out = 0;
+	for (i = 0; i < ICB_STATS_TYPES; i++) {
+		packets_in += stats->packets_in[i];
+		bytes_in += stats->bytes_in[i];
+		packets_out += stats->packets_out[i];
+		bytes_out += stats->bytes_out[i];
+	}
+
+	print_stat(server, "Packets in", "%lu, %lu bytes, %lu continued",
+		   packets_in, bytes_in, stats->blocks_in);
+	print_stat(server, "Packets out", "%lu, %lu bytes, %lu continued",
+		   packets_out, bytes_out, stats->blocks_out);
+
+	for (i = 0; i < ICB_STATS_TYPES; i++) {
+		if (stats->packets_in[i] == 0 && stats->packets_out[i] == 0)
+			continue;
+
+		g_snprintf(name, sizeof(name), "  '%c' packets", 'a' + i);
+		print_stat(server, name, "%lu in (%lu bytes), "
+			   "%lu out (%lu bytes)", stats->packets_in[i],
+			   stats->bytes_in[i], stats->packets_out[i],
+			   stats->bytes_out[i]);
+		if (stats->handler_time[i] != NULL) {
+			g_snprintf(name, sizeof(name), "  '%c' handled in",
+				   'a' + i);
+			print_histogram(server, name, stats->handler_time[i],
+					"us");
+		}
+	}
+
+	if (server->read_wakeups > 0) {
+		print_stat(server, "Socket reads per wakeup", "%.2f",
+			   (double) stats->socket_reads /
+			   server->read_wakeups);
+	}
+	print_histogram(server, "Packets per wakeup",
+			&stats->wakeup_packets, "packets");
+	print_histogram(server, "Packet read in", &stats->read_time, "us");
+	print_histogram(server, "Packet handled in",
+			&stats->dispatch_time, "us");
+	print_histogram(server, "Send queue depth", &stats->sendq_depth,
+			"bytes");
+	if (stats->who_sync.count > 0) {
+		print_stat(server, "Nicklist syncs", "%lu, %.1f ms average",
+			   stats->who_sync.count,
+			   (double) stats->who_sync.sum / 1000.0 /
+			   stats->who_sync.count);
+	}
+}
+
+static void print_stats(ICB_SERVER_REC *server)
+{
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_STATS_HEADER,
+		    server->tag);
+
+	print_connect_stats(server);
+	print_stat(server, "Read wakeups", "%lu", server->read_wakeups);
+	print_stat(server, "Read budget exhausted", "%lu",
+		   server->read_deferred);
+	print_stat(server, "Receive backlog", "%d bytes (max %d)",
+		   server->recvbuf_pos - server->recvbuf_start,
+		   server->read_max_backlog);
+	print_stat(server, "Packets queued", "%lu, sent in %lu writes",
+		   server->send_packets, server->send_flushes);
+	print_stat(server, "Control packets", "%lu sent, %d bytes queued",
+		   server->sendq_sent[ICB_SENDQ_CONTROL],
+		   icb_sendq_length(server, ICB_SENDQ_CONTROL));
+	print_stat(server, "Command packets", "%lu sent, %d bytes queued",
+		   server->sendq_sent[ICB_SENDQ_COMMAND],
+		   icb_sendq_length(server, ICB_SENDQ_COMMAND));
+	print_stat(server, "Message packets", "%lu sent, %d bytes queued",
+		   server->sendq_sent[ICB_SENDQ_BULK],
+		   icb_sendq_length(server, ICB_SENDQ_BULK));
+	print_stat(server, "Send queue", "%d bytes (max %d), %d unwritten",
+		   icb_sendq_queued(server), server->sendq_high,
+		   (int) server->sendq_out->len);
+	if (server->sendq_dropped > 0 || server->sendq_spilled_bytes > 0) {
+		print_stat(server, "Send queue overflow",
+			   "%lu messages (%lu bytes) refused, "
+			   "%lu bytes spilled, %ld on disk",
+			   server->sendq_dropped, server->sendq_dropped_bytes,
+			   server->sendq_spilled_bytes,
+			   server->sendq_spill_size);
+	}
+	print_stat(server, "Group switches", "%lu, %lu shown from cache",
+		   server->group_switches, server->group_cache_hits);
+	if (server->group_syncs > 0) {
+		/* switches left before they were synced aren't counted */
+		print_stat(server, "Group switch latency",
+			   "%.1f ms until shown, %.1f ms until synced",
+			   server->group_show_time / 1000.0 /
+			   server->group_shows,
+			   server->group_sync_time / 1000.0 /
+			   server->group_syncs);
+	}
+	if (server->requests_done > 0) {
+		print_stat(server, "Requests", "%lu done in %.1f ms average, "
+			   "%d pending", server->requests_done,
+			   server->request_time / 1000.0 /
+			   server->requests_done,
+			   server->requests == NULL ? 0 :
+			   (int) g_queue_get_length(server->requests));
+	}
+	if (server->connrec->dead_peers > 0) {
+		print_stat(server, "Dead connections", "%u dropped, "
+			   "%.1f s average to detect",
+			   server->connrec->dead_peers,
+			   server->connrec->dead_peer_time / 1000000.0 /
+			   server->connrec->dead_peers);
+	}
+	if (server->directory != NULL) {
+		print_stat(server, "User directory", "%u users, %lu bytes",
+			   g_hash_table_size(server->directory->users),
+			   (unsigned long) icb_directory_size(server));
+	}
+	print_packet_stats(server);
+}
+
+/* SYNTAX: ICB STATS [-reset] [-quiet] */
+static void cmd_icb_stats(const char *data, ICB_SERVER_REC *server)
+{
+	GHashTable *optlist;
+	void *free_arg;
+	char *stats;
+
+	CMD_ICB_SERVER(server);
+
+	if (!cmd_get_params(data, &free_arg, PARAM_FLAG_OPTIONS,
+			    "icb stats", &optlist))
+		return;
+
+	/* for scripts */
+	stats = icb_stats_get(server);
+	signal_emit("icb stats", 2, server, stats);
+	g_free(stats);
+
+	if (g_hash_table_lookup(optlist, "quiet") == NULL)
+		print_stats(server);
+	if (g_hash_table_lookup(optlist, "reset") != NULL)
+		icb_stats_reset(server);
+	cmd_params_free(free_arg);
+}
+
+static void print_lag(ICB_SERVER_REC *server, const char *name,
+		      double usecs)
+{
+	char value[32];
+
+	g_snprintf(value, sizeof(value), "%.1f", usecs / 1000.0);
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_LAG,
+		    name, value);
+}
+
+static void print_lag_histogram(ICB_SERVER_REC *server,
+				ICB_HISTOGRAM_REC *hist)
+{
+	char low[32], high[32];
+	int i;
+
+	for (i = 0; i < ICB_HISTOGRAM_BUCKETS; i++) {
+		if (hist->buckets[i] == 0)
+			continue;
+
+		g_snprintf(low, sizeof(low), "%.1f",
+			   icb_histogram_bucket_low(i) / 1000.0);
+		g_snprintf(high, sizeof(high), "%.1f",
+			   (i + 1 < ICB_HISTOGRAM_BUCKETS ?
+			    icb_histogram_bucket_low(i + 1) : hist->max) /
+			   1000.0);
+		printformat(server, NULL, MSGLEVEL_CLIENTCRAP,
+			    ICBTXT_LAG_BUCKET, low, high, hist->buckets[i]);
+	}
+}
+
+/* SYNTAX: ICB LAG [-histogram] */
+static void cmd_icb_lag(const char *data, ICB_SERVER_REC *server)
+{
+	ICB_HISTOGRAM_REC *hist;
+	GHashTable *optlist;
+	void *free_arg;
+	char last[32];
+
+	CMD_ICB_SERVER(server);
+
+	if (!cmd_get_params(data, &free_arg, PARAM_FLAG_OPTIONS,
+			    "icb lag", &optlist))
+		return;
+
+	hist = server->lag_histogram;
+	if (hist == NULL || hist->count == 0) {
+		printformat(server, NULL, MSGLEVEL_CLIENTCRAP,
+			    ICBTXT_LAG_NONE, server->tag);
+		cmd_params_free(free_arg);
+		return;
+	}
+
+	g_snprintf(last, sizeof(last), "%d", server->lag);
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_LAG_HEADER,
+		    server->tag, last, (int) hist->count);
+
+	print_lag(server, "min", hist->min);
+	print_lag(server, "average", (double) hist->sum / hist->count);
+	print_lag(server, "50%", icb_histogram_percentile(hist, 50));
+	print_lag(server, "90%", icb_histogram_percentile(hist, 90));
+	print_lag(server, "99%", icb_histogram_percentile(hist, 99));
+	print_lag(server, "max", hist->max);
+
+	if (g_hash_table_lookup(optlist, "histogram") != NULL)
+		print_lag_histogram(server, hist);
+	cmd_params_free(free_arg);
+}
+
+/* Format the idle time of user into idlebuf, returns user@host */
+static char *directory_user_info(ICB_USER_REC *user, char *idlebuf,
+				 size_t size)
+{
+	if (user->idle_since != 0)
+		idle_time(idlebuf, size, time(NULL) - user->idle_since);
+	else
+		g_strlcpy(idlebuf, "?", size);
+
+	return g_strconcat(user->user != NULL ? user->user : "?", "@",
+			   user->host != NULL ? user->host : "?", NULL);
+}
+
+/* SYNTAX: WHEREIS <nick> */
+static void cmd_whereis(const char *data, ICB_SERVER_REC *server)
+{
+	ICB_USER_REC *user;
+	char idlebuf[20];
+	char *userhost;
+
+	CMD_ICB_SERVER(server);
+
+	/* answer from the directory, unknown or stale users go to the
+	   server */
+	user = icb_directory_find(server, data);
+	if (user == NULL || !icb_directory_fresh(server, user))
+		return;
+
+	userhost = directory_user_info(user, idlebuf, sizeof(idlebuf));
+
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_WHEREIS,
+		    user->nick, user->group->name, idlebuf,
+		    userhost);
+	g_free(userhost);
+	signal_stop();
+}
+
+/* Print the reply in the window item /whois was given in */
+static void whois_reply(ICB_SERVER_REC *server, ICB_PACKET_REC *packet,
+			char *target)
+{
+	char *data;
+
+	if (packet == NULL)
+		return;
+
+	who_output_flush(server);
+	if (strcmp(packet->fields[0], "co") == 0) {
+		printtext(server, target, MSGLEVEL_CRAP, "%s",
+			  packet->fields[1]);
+	} else {
+		data = g_strjoinv(" ", packet->fields+1);
+		printtext(server, target, MSGLEVEL_CRAP, "%s", data);
+		g_free(data);
+	}
+	signal_stop();
+}
+
+/* SYNTAX: WHOIS <nick> */
+static void cmd_whois(const char *data, ICB_SERVER_REC *server,
+		      WI_ITEM_REC *item)
+{
+	CMD_ICB_SERVER(server);
+
+	icb_request(server, "whois", data, (ICB_REQUEST_FUNC) whois_reply,
+		    g_strdup(item != NULL ? item->visible_name : NULL),
+		    g_free);
+	signal_stop();
+}
+
+static void print_directory_user(void *key, ICB_USER_REC *user,
+				 ICB_SERVER_REC *server)
+{
+	char idlebuf[20];
+	char *userhost;
+
+	userhost = directory_user_info(user, idlebuf, sizeof(idlebuf));
+
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_DIRECTORY_USER,
+		    user->nick, idlebuf, userhost);
+	g_free(userhost);
+}
+
+static void print_directory_group(void *key, ICB_DIRGROUP_REC *group,
+				  ICB_SERVER_REC *server)
+{
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_DIRECTORY_GROUP,
+		    group->name, g_hash_table_size(group->users));
+}
+
+/* SYNTAX: ICB DIRECTORY [<group>] */
+static void cmd_icb_directory(const char *data, ICB_SERVER_REC *server)
+{
+	ICB_DIRECTORY_REC *dir;
+	ICB_DIRGROUP_REC *group;
+	char *bytes;
+
+	CMD_ICB_SERVER(server);
+
+	dir = server->directory;
+	if (*data != '\0') {
+		group = icb_directory_find_group(server, data);
+		if (group != NULL) {
+			g_hash_table_foreach(group->users,
+					     (GHFunc) print_directory_user,
+					     server);
+		}
+		return;
+	}
+
+	bytes = g_strdup_printf("%lu",
+				(unsigned long) icb_directory_size(server));
+	printformat(server, NULL, MSGLEVEL_CLIENTCRAP, ICBTXT_DIRECTORY_HEADER,
+		    server->tag,
+		    dir == NULL ? 0 : g_hash_table_size(dir->users),
+		    dir == NULL ? 0 : g_hash_table_size(dir->groups), bytes);
+	g_free(bytes);
+
+	if (dir != NULL) {
+		g_hash_table_foreach(dir->groups,
+				     (GHFunc) print_directory_group, server);
+	}
+}
+
+/* /msg <nick> completes from everyone on the server */
+static void sig_complete_msg(GList **list, WINDOW_REC *window,
+			     const char *word, const char *line,
+			     int *want_space)
+{
+	ICB_SERVER_REC *server;
+
+	server = ICB_SERVER(window->active_server);
+	if (server == NULL || *line != '\0')
+		return;
+
+	*list = icb_directory_complete(server, word, *list, 50);
 }
 
 static void sig_server_add_fill(SERVER_SETUP_REC *rec,
@@ -485,10 +1007,18 @@ void fe_icb_init(void)
 {
 	theme_register(fecommon_icb_formats);
 
+        signal_add_first("icb event open", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_add_first("icb event personal", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_add_first("icb event status", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_add_first("icb event important", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_add_first("icb event error", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_add_first("server disconnected", (SIGNAL_FUNC) sig_who_output_flush);
         signal_add("icb event error", (SIGNAL_FUNC) event_error);
         signal_add("icb event important", (SIGNAL_FUNC) event_important);
         signal_add("icb event beep", (SIGNAL_FUNC) event_beep);
         signal_add("icb event open", (SIGNAL_FUNC) event_open);
+	signal_add("icb send queue full", (SIGNAL_FUNC) sig_sendq_full);
+	signal_add("icb send queue drained", (SIGNAL_FUNC) sig_sendq_drained);
         signal_add("icb event personal", (SIGNAL_FUNC) event_personal);
         signal_add("icb cmdout co", (SIGNAL_FUNC) cmdout_co);
         signal_add("icb cmdout wl", (SIGNAL_FUNC) cmdout_wl);
@@ -498,6 +1028,8 @@ void fe_icb_init(void)
         signal_add("icb status sign-on", (SIGNAL_FUNC) status_signon);
         signal_add("icb status sign-off", (SIGNAL_FUNC) status_signoff);
         signal_add("icb status status", (SIGNAL_FUNC) status_join);
+        signal_add("server connected", (SIGNAL_FUNC) sig_server_connected);
+        signal_add("icb nicklist synced", (SIGNAL_FUNC) sig_nicklist_synced);
         signal_add("icb status topic", (SIGNAL_FUNC) status_topic);
         signal_add("icb status name", (SIGNAL_FUNC) status_name);
         signal_add("icb status pass", (SIGNAL_FUNC) status_pass);
@@ -506,15 +1038,32 @@ void fe_icb_init(void)
 	signal_add("server add fill", (SIGNAL_FUNC) sig_server_add_fill);
 	command_set_options("server add", "-icbnet");
 
+	command_bind_icb("icb stats", NULL, (SIGNAL_FUNC) cmd_icb_stats);
+	command_set_options("icb stats", "reset quiet");
+	command_bind_icb("icb directory", NULL, (SIGNAL_FUNC) cmd_icb_directory);
+	command_bind_icb("icb lag", NULL, (SIGNAL_FUNC) cmd_icb_lag);
+	command_set_options("icb lag", "histogram");
+	command_bind_icb_first("whereis", NULL, (SIGNAL_FUNC) cmd_whereis);
+	command_bind_icb_first("whois", NULL, (SIGNAL_FUNC) cmd_whois);
+	signal_add("complete command msg", (SIGNAL_FUNC) sig_complete_msg);
+
 	module_register("icb", "fe");
 }
 
 void fe_icb_deinit(void)
 {
+        signal_remove("icb event open", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_remove("icb event personal", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_remove("icb event status", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_remove("icb event important", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_remove("icb event error", (SIGNAL_FUNC) sig_who_output_flush);
+        signal_remove("server disconnected", (SIGNAL_FUNC) sig_who_output_flush);
         signal_remove("icb event error", (SIGNAL_FUNC) event_error);
         signal_remove("icb event important", (SIGNAL_FUNC) event_important);
         signal_remove("icb event beep", (SIGNAL_FUNC) event_beep);
         signal_remove("icb event open", (SIGNAL_FUNC) event_open);
+	signal_remove("icb send queue full", (SIGNAL_FUNC) sig_sendq_full);
+	signal_remove("icb send queue drained", (SIGNAL_FUNC) sig_sendq_drained);
         signal_remove("icb event personal", (SIGNAL_FUNC) event_personal);
         signal_remove("icb cmdout co", (SIGNAL_FUNC) cmdout_co);
         signal_remove("icb cmdout wl", (SIGNAL_FUNC) cmdout_wl);
@@ -524,10 +1073,19 @@ void fe_icb_deinit(void)
         signal_remove("icb status sign-on", (SIGNAL_FUNC) status_signon);
         signal_remove("icb status sign-off", (SIGNAL_FUNC) status_signoff);
         signal_remove("icb status status", (SIGNAL_FUNC) status_join);
+        signal_remove("server connected", (SIGNAL_FUNC) sig_server_connected);
+        signal_remove("icb nicklist synced", (SIGNAL_FUNC) sig_nicklist_synced);
         signal_remove("icb status topic", (SIGNAL_FUNC) status_topic);
         signal_remove("icb status name", (SIGNAL_FUNC) status_name);
         signal_remove("icb status pass", (SIGNAL_FUNC) status_pass);
         signal_remove("default icb status", (SIGNAL_FUNC) status_default);
 
 	signal_remove("server add fill", (SIGNAL_FUNC) sig_server_add_fill);
+
+	command_unbind("icb stats", (SIGNAL_FUNC) cmd_icb_stats);
+	command_unbind("icb directory", (SIGNAL_FUNC) cmd_icb_directory);
+	command_unbind("icb lag", (SIGNAL_FUNC) cmd_icb_lag);
+	command_unbind("whereis", (SIGNAL_FUNC) cmd_whereis);
+	command_unbind("whois", (SIGNAL_FUNC) cmd_whois);
+	signal_remove("complete command msg", (SIGNAL_FUNC) sig_complete_msg);
 }
@@ -31,6 +31,26 @@ FORMAT_REC fecommon_icb_formats[] = {
 	{ "important", "[$0!] $1", 2, { 0, 0 } },
 	{ "status", "{error [Error]} $0", 1, { 0 } },
 	{ "beep", "[Beep] $0 beeps you", 1, { 0 } },
+	{ "sendq_full", "{error Send queue to {server $0} is full} ($1 bytes), messages are not sent until it drains", 2, { 0, 1 } },
+	{ "sendq_drained", "Send queue to {server $0} has drained", 1, { 0 } },
+
+	/* ---- */
+	{ NULL, "Statistics", 0 },
+
+	{ "stats_header", "ICB statistics for {server $0}", 1, { 0 } },
+	{ "stats", "  $[30]0 $1", 2, { 0, 0 } },
+	{ "lag_header", "Lag of {server $0} is $1 ms, measured $2 times", 3, { 0, 0, 1 } },
+	{ "lag_none", "Lag of {server $0} not measured yet", 1, { 0 } },
+	{ "lag", "  $[10]0 $1 ms", 2, { 0, 0 } },
+	{ "lag_bucket", "  $[-10]0 - $[-10]1 ms $2", 3, { 0, 0, 1 } },
+
+	/* ---- */
+	{ NULL, "User directory", 0 },
+
+	{ "whereis", "{nick $0} is in group {channel $1}, idle $2 {nickhost $3}", 4, { 0, 0, 0, 0 } },
+	{ "directory_header", "{server $0} has $1 users in $2 groups, using $3 bytes", 4, { 0, 1, 1, 0 } },
+	{ "directory_group", "  $[20]0 $1 users", 2, { 0, 1 } },
+	{ "directory_user", "  $[15]0 $[7]1 {nickhost $2}", 3, { 0, 0, 0 } },
 
 	{ NULL, NULL, 0 }
 };
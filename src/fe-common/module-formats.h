@@ -8,7 +8,25 @@ enum {
 	ICBTXT_STATUS,
 	ICBTXT_IMPORTANT,
 	ICBTXT_ERROR,
-	ICBTXT_BEEP
+	ICBTXT_BEEP,
+	ICBTXT_SENDQ_FULL,
+	ICBTXT_SENDQ_DRAINED,
+
+	ICBTXT_FILL_2,
+
+	ICBTXT_STATS_HEADER,
+	ICBTXT_STATS,
+	ICBTXT_LAG_HEADER,
+	ICBTXT_LAG_NONE,
+	ICBTXT_LAG,
+	ICBTXT_LAG_BUCKET,
+
+	ICBTXT_FILL_3,
+
+	ICBTXT_WHEREIS,
+	ICBTXT_DIRECTORY_HEADER,
+	ICBTXT_DIRECTORY_GROUP,
+	ICBTXT_DIRECTORY_USER
 };
 
 extern FORMAT_REC fecommon_icb_formats[];
@@ -0,0 +1,411 @@
+/*
+ icb-bench.c : benchmarks for the ICB protocol and front end code
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <unistd.h>
+
+#include "module.h"
+
+#include "icb-servers.h"
+#include "icb-channels.h"
+#include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-directory.h"
+#include "icb-request.h"
+
+#include "stub-core.h"
+
+void fe_icb_init(void);
+void fe_icb_deinit(void);
+
+typedef struct {
+	const char *name;
+	void (*run)(ICB_SERVER_REC *server, int rounds);
+	int rounds;
+} BENCH_REC;
+
+static const char *usage =
+	"usage: icb-bench [-s scale] [benchmark...]\n"
+	"  -s scale  multiply the number of rounds by scale\n";
+
+static unsigned long allocs;
+
+#ifdef __GLIBC__
+/* count the allocations, g_malloc() and friends end up here too */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT
+#endif
+
+static gint64 bench_started;
+static unsigned long bench_allocs;
+
+static void bench_start(void)
+{
+	bench_allocs = allocs;
+	bench_started = g_get_monotonic_time();
+}
+
+static void bench_end(const char *name, unsigned long packets)
+{
+	gint64 elapsed;
+	unsigned long count;
+
+	elapsed = g_get_monotonic_time() - bench_started;
+	count = allocs - bench_allocs;
+	if (elapsed <= 0)
+		elapsed = 1;
+	if (packets == 0)
+		packets = 1;
+
+	printf("%-22s %10lu %12.0f %10.1f ", name, packets,
+	       packets * 1000000.0 / elapsed, elapsed * 1000.0 / packets);
+#ifdef HAVE_ALLOC_COUNT
+	printf("%13.2f\n", (double) count / packets);
+#else
+	printf("%13s\n", "-");
+#endif
+}
+
+/* Append a packet of type with the given fields to buf, framed in 256
+   byte blocks the way the server sends it */
+static void add_packet(GString *buf, int type, ...)
+{
+	GString *data;
+	const char *field;
+	va_list va;
+	int pos, len;
+
+	data = g_string_new(NULL);
+	g_string_append_c(data, type);
+
+	va_start(va, type);
+	while ((field = va_arg(va, const char *)) != NULL) {
+		if (data->len > 1)
+			g_string_append_c(data, '\001');
+		g_string_append(data, field);
+	}
+	va_end(va);
+	g_string_append_len(data, "", 1);
+
+	for (pos = 0; data->len - pos > 255; pos += 255) {
+		g_string_append_c(buf, '\0');
+		g_string_append_len(buf, data->str + pos, 255);
+	}
+	len = data->len - pos;
+	g_string_append_c(buf, len);
+	g_string_append_len(buf, data->str + pos, len);
+
+	g_string_free(data, TRUE);
+}
+
+static unsigned long feed(ICB_SERVER_REC *server, GString *buf, int rounds)
+{
+	unsigned long packets;
+	int i;
+
+	packets = 0;
+	for (i = 0; i < rounds; i++)
+		packets += icb_protocol_feed(server, buf->str, buf->len);
+	return packets;
+}
+
+static GString *open_messages(int count)
+{
+	GString *buf;
+	char nick[20], text[100];
+	int i;
+
+	buf = g_string_new(NULL);
+	for (i = 0; i < count; i++) {
+		g_snprintf(nick, sizeof(nick), "user%d", i % 50);
+		g_snprintf(text, sizeof(text),
+			   "message number %d from the benchmark", i);
+		add_packet(buf, 'b', nick, text, NULL);
+	}
+	return buf;
+}
+
+/* micro: frame, parse and emit packets nobody handles */
+static void bench_framing(ICB_SERVER_REC *server, int rounds)
+{
+	GString *buf;
+	unsigned long packets;
+
+	buf = open_messages(1000);
+	bench_start();
+	packets = feed(server, buf, rounds);
+	bench_end("framing", packets);
+	g_string_free(buf, TRUE);
+}
+
+/* micro: split a packet into fields */
+static void bench_parse(ICB_SERVER_REC *server, int rounds)
+{
+	ICB_PACKET_REC packet;
+	char data[] = "iwl\001 \001someuser\0010\0010\0011234567890"
+		"\001username\001host.example.org\001(nr)";
+	unsigned long i, count;
+	int j, len;
+
+	len = strlen(data);
+	count = (unsigned long) rounds * 1000;
+
+	bench_start();
+	for (i = 0; i < count; i++) {
+		icb_packet_parse(&packet, data, len);
+		/* put the separators back */
+		for (j = 0; j < packet.count-1; j++)
+			packet.fields[j][packet.lengths[j]] = '\001';
+	}
+	bench_end("parse", count);
+}
+
+/* micro: split long messages into packets */
+static void bench_splitter(ICB_SERVER_REC *server, int rounds)
+{
+	GString *text;
+	unsigned long packets;
+	int i;
+
+	text = g_string_new(NULL);
+	while (text->len < 2000)
+		g_string_append(text, "the quick brown fox jumps over the "
+				"lazy dog \xc3\xa4\xc3\xb6\xc3\xbc ");
+
+	packets = server->send_packets;
+	bench_start();
+	for (i = 0; i < rounds * 10; i++) {
+		icb_send_open_msg(server, text->str);
+		icb_send_private_msg(server, "someone", text->str);
+		icb_sendq_flush(server);
+	}
+	bench_end("splitter", server->send_packets - packets);
+	g_string_free(text, TRUE);
+}
+
+/* micro: route status and command output packets by their category */
+static void bench_dispatch(ICB_SERVER_REC *server, int rounds)
+{
+	static const char *status[] = {
+		"Arrive", "Depart", "Sign-on", "Sign-off", "Name",
+		"Topic", "Pass", "Notify", "FYI", "Unknown-Category"
+	};
+	static const char *cmdout[] = { "co", "ec", "gh", "xx" };
+	GString *buf;
+	unsigned long packets;
+	int i;
+
+	buf = g_string_new(NULL);
+	for (i = 0; i < 1000; i++) {
+		if (i % 3 == 0) {
+			add_packet(buf, 'i', cmdout[i % G_N_ELEMENTS(cmdout)],
+				   "some output", NULL);
+		} else {
+			add_packet(buf, 'd', status[i % G_N_ELEMENTS(status)],
+				   "nick (user@host) did something", NULL);
+		}
+	}
+
+	bench_start();
+	packets = feed(server, buf, rounds);
+	bench_end("dispatch", packets);
+	g_string_free(buf, TRUE);
+}
+
+/* full /who listing our group with 10k users */
+static GString *who_listing(void)
+{
+	GString *buf;
+	char nick[20], idle[20];
+	int i;
+
+	buf = g_string_new(NULL);
+	add_packet(buf, 'i', "co", "Group: 1  (rvl) Mod: admin "
+		   "Topic: benchmarking", NULL);
+	for (i = 0; i < 10000; i++) {
+		g_snprintf(nick, sizeof(nick), "user%05d", i);
+		g_snprintf(idle, sizeof(idle), "%d", i * 7);
+		add_packet(buf, 'i', "wl", i == 0 ? "m" : " ", nick, idle,
+			   "0", "1234567890", "login", "host.example.org",
+			   "(nr)", NULL);
+	}
+	add_packet(buf, 'i', "co", "Total: 10000 users in 1 group", NULL);
+	return buf;
+}
+
+/* macro: silent /who of 10k users filling an empty nicklist */
+static void bench_who(ICB_SERVER_REC *server, int rounds)
+{
+	GString *buf;
+	unsigned long packets;
+	int i;
+
+	buf = who_listing();
+	packets = 0;
+	bench_start();
+	for (i = 0; i < rounds; i++) {
+		server->silentwho = TRUE;
+		packets += feed(server, buf, 1);
+		stub_nicklist_clear(CHANNEL(server->group));
+	}
+	bench_end("who 10k users", packets);
+	g_string_free(buf, TRUE);
+}
+
+/* macro: the same /who again with the nicklist already in sync */
+static void bench_resync(ICB_SERVER_REC *server, int rounds)
+{
+	GString *buf;
+	unsigned long packets;
+	int i;
+
+	buf = who_listing();
+	server->silentwho = TRUE;
+	feed(server, buf, 1);
+
+	packets = 0;
+	bench_start();
+	for (i = 0; i < rounds; i++) {
+		server->silentwho = TRUE;
+		packets += feed(server, buf, 1);
+	}
+	bench_end("who 10k resync", packets);
+	stub_nicklist_clear(CHANNEL(server->group));
+	g_string_free(buf, TRUE);
+}
+
+/* macro: open messages through the front end */
+static void bench_open(ICB_SERVER_REC *server, int rounds)
+{
+	GString *buf;
+	unsigned long packets;
+
+	buf = open_messages(100000);
+	bench_start();
+	packets = feed(server, buf, rounds);
+	bench_end("open messages", packets);
+	g_string_free(buf, TRUE);
+}
+
+/* these run before the front end handlers are added */
+static BENCH_REC micro_benchmarks[] = {
+	{ "framing", bench_framing, 200 },
+	{ "parse", bench_parse, 2000 },
+	{ "splitter", bench_splitter, 200 },
+	{ "dispatch", bench_dispatch, 200 }
+};
+
+static BENCH_REC macro_benchmarks[] = {
+	{ "who", bench_who, 20 },
+	{ "resync", bench_resync, 20 },
+	{ "open", bench_open, 5 }
+};
+
+static int bench_selected(const char *name, char **names, int count)
+{
+	int i;
+
+	if (count == 0)
+		return TRUE;
+
+	for (i = 0; i < count; i++) {
+		if (strcmp(names[i], name) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void run_benchmarks(BENCH_REC *benchmarks, int count,
+			   ICB_SERVER_REC *server, int scale,
+			   char **names, int names_count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (bench_selected(benchmarks[i].name, names, names_count))
+			benchmarks[i].run(server, benchmarks[i].rounds * scale);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	ICB_SERVER_REC *server;
+	int c, scale;
+
+	scale = 1;
+	while ((c = getopt(argc, argv, "s:")) != -1) {
+		switch (c) {
+		case 's':
+			scale = atoi(optarg);
+			break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (scale <= 0) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	stub_core_init();
+	icb_protocol_init();
+	icb_sendq_init();
+	icb_directory_init();
+	icb_request_init();
+	server = stub_server_create("bench");
+
+	printf("%-22s %10s %12s %10s %13s\n", "benchmark", "packets",
+	       "packets/s", "ns/packet", "allocs/packet");
+
+	run_benchmarks(micro_benchmarks, G_N_ELEMENTS(micro_benchmarks),
+		       server, scale, argv + optind, argc - optind);
+
+	fe_icb_init();
+	run_benchmarks(macro_benchmarks, G_N_ELEMENTS(macro_benchmarks),
+		       server, scale, argv + optind, argc - optind);
+	fe_icb_deinit();
+
+	stub_server_destroy(server);
+	icb_request_deinit();
+	icb_directory_deinit();
+	icb_sendq_deinit();
+	icb_protocol_deinit();
+	stub_core_deinit();
+	return 0;
+}
@@ -0,0 +1,880 @@
+/*
+ icb-fake-server.c : local ICB server stand-in for load and latency tests
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+/*
+ * Speaks enough of the server side of the ICB protocol for the irssi
+ * module: the protocol and login packets, open, personal, status and
+ * command output packets, ping/pong and who listings. The population of
+ * fake users only exists in who listings and status floods.
+ *
+ * Every logged in client can be flooded with status lines and open
+ * messages at a fixed rate and pinged at an interval, the pong round-trip
+ * time is reported along with the throughput. A script file can be run
+ * for each client after it has logged in, see usage below.
+ */
+
+#define DEFAULT_PORT 7326
+
+/* stop generating floods for a client that has this much unsent */
+#define MAX_OUTBUF (1024*1024)
+
+typedef struct {
+	int fd;
+	char *nick;
+	char *group;
+	int logged_in;
+
+	GString *inbuf, *outbuf;
+
+	/* script state */
+	int script_pos;
+	gint64 sleep_until;
+	int flood_type;		/* 'b' or 'd' while a scripted flood runs */
+	int flood_count, flood_rate, flood_sent;
+	gint64 flood_started;
+
+	/* continuous floods */
+	gint64 started;
+	unsigned long status_sent, open_sent;
+	gint64 next_ping;
+} CLIENT_REC;
+
+typedef struct {
+	unsigned long packets_out, bytes_out;
+	unsigned long packets_in, bytes_in, opens_in;
+	unsigned long pongs;
+	gint64 rtt_total, rtt_min, rtt_max;
+} STATS_REC;
+
+static const char *usage =
+	"usage: icb-fake-server [options]\n"
+	"  -P port      port to listen on (default 7326)\n"
+	"  -u users     fake users in who listings (default 100)\n"
+	"  -G groups    groups the fake users are spread over (default 1)\n"
+	"  -s rate      status lines per second to every client\n"
+	"  -o rate      open messages per second to every client\n"
+	"  -L length    text length of flooded open messages (default 40),\n"
+	"               over 250 makes them multi-block packets\n"
+	"  -i msecs     ping every client at this interval and report the\n"
+	"               round-trip time (default 1000, 0 disables)\n"
+	"  -r secs      report interval (default 1, 0 disables)\n"
+	"  -f file      script to run for each client after login\n"
+	"\n"
+	"script lines:\n"
+	"  sleep <msecs>\n"
+	"  open <nick> <text>\n"
+	"  personal <nick> <text>\n"
+	"  status <category> <text>\n"
+	"  error <text>\n"
+	"  big <bytes>                 one open message of this size\n"
+	"  flood open|status <count> <rate/s>\n"
+	"  ping\n"
+	"  quit                        disconnect the client\n";
+
+static int opt_users = 100, opt_groups = 1;
+static int opt_status_rate, opt_open_rate, opt_length = 40;
+static int opt_ping_interval = 1000, opt_report = 1;
+static char **script;
+
+static GSList *clients;
+static STATS_REC stats, interval_stats;
+static volatile sig_atomic_t quit;
+
+static void stats_add_rtt(STATS_REC *rec, gint64 rtt)
+{
+	if (rec->pongs == 0 || rtt < rec->rtt_min)
+		rec->rtt_min = rtt;
+	if (rtt > rec->rtt_max)
+		rec->rtt_max = rtt;
+	rec->rtt_total += rtt;
+	rec->pongs++;
+}
+
+static void stats_print(const char *prefix, STATS_REC *rec, double secs)
+{
+	if (secs <= 0)
+		secs = 1;
+
+	printf("%s: %d clients, out %.0f packets/s %.0f kB/s, "
+	       "in %.0f packets/s (%.0f opens/s)", prefix,
+	       g_slist_length(clients), rec->packets_out / secs,
+	       rec->bytes_out / secs / 1024, rec->packets_in / secs,
+	       rec->opens_in / secs);
+	if (rec->pongs > 0) {
+		printf(", rtt min/avg/max %.2f/%.2f/%.2f ms",
+		       rec->rtt_min / 1000.0,
+		       rec->rtt_total / 1000.0 / rec->pongs,
+		       rec->rtt_max / 1000.0);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/* Queue a packet of type with the given fields to client, framed in 256
+   byte blocks */
+static void send_packet(CLIENT_REC *client, int type, ...)
+{
+	GString *data;
+	const char *field;
+	va_list va;
+	int pos, len, first;
+
+	data = g_string_new(NULL);
+	g_string_append_c(data, type);
+
+	first = TRUE;
+	va_start(va, type);
+	while ((field = va_arg(va, const char *)) != NULL) {
+		if (!first)
+			g_string_append_c(data, '\001');
+		g_string_append(data, field);
+		first = FALSE;
+	}
+	va_end(va);
+	g_string_append_len(data, "", 1);
+
+	for (pos = 0; data->len - pos > 255; pos += 255) {
+		g_string_append_c(client->outbuf, '\0');
+		g_string_append_len(client->outbuf, data->str + pos, 255);
+	}
+	len = data->len - pos;
+	g_string_append_c(client->outbuf, len);
+	g_string_append_len(client->outbuf, data->str + pos, len);
+
+	interval_stats.packets_out++;
+	interval_stats.bytes_out += data->len;
+	g_string_free(data, TRUE);
+}
+
+static void send_status(CLIENT_REC *client, const char *category,
+			const char *fmt, ...)
+{
+	va_list va;
+	char *text;
+
+	va_start(va, fmt);
+	text = g_strdup_vprintf(fmt, va);
+	va_end(va);
+
+	send_packet(client, 'd', category, text, NULL);
+	g_free(text);
+}
+
+static CLIENT_REC *client_find(const char *nick)
+{
+	GSList *tmp;
+
+	for (tmp = clients; tmp != NULL; tmp = tmp->next) {
+		CLIENT_REC *client = tmp->data;
+
+		if (client->nick != NULL &&
+		    g_ascii_strcasecmp(client->nick, nick) == 0)
+			return client;
+	}
+	return NULL;
+}
+
+static const char *fake_group(int user)
+{
+	static char group[20];
+
+	g_snprintf(group, sizeof(group), "%d", user % opt_groups + 1);
+	return group;
+}
+
+static void send_wl(CLIENT_REC *client, int mod, const char *nick,
+		    int idle, const char *user, const char *host)
+{
+	char idlestr[20], login[20];
+
+	g_snprintf(idlestr, sizeof(idlestr), "%d", idle);
+	g_snprintf(login, sizeof(login), "%ld",
+		   (long) (time(NULL) - 3600 - idle));
+	send_packet(client, 'i', "wl", mod ? "*" : " ", nick, idlestr, "0",
+		    login, user, host, "(nr)", NULL);
+}
+
+static void send_group_who(CLIENT_REC *client, const char *group)
+{
+	GSList *tmp;
+	char nick[20], *header;
+	int i;
+
+	header = g_strdup_printf("Group: %-8s (rvl) Mod: user0  "
+				 "Topic: fake group %s", group, group);
+	send_packet(client, 'i', "co", header, NULL);
+	g_free(header);
+
+	for (tmp = clients; tmp != NULL; tmp = tmp->next) {
+		CLIENT_REC *rec = tmp->data;
+
+		if (rec->logged_in &&
+		    g_ascii_strcasecmp(rec->group, group) == 0)
+			send_wl(client, FALSE, rec->nick, 0, "client",
+				"localhost");
+	}
+
+	for (i = 0; i < opt_users; i++) {
+		if (g_ascii_strcasecmp(fake_group(i), group) != 0)
+			continue;
+
+		g_snprintf(nick, sizeof(nick), "user%d", i);
+		send_wl(client, i == 0, nick, i * 7 % 10000, "fake",
+			"fake.example.org");
+	}
+}
+
+/* "w" lists every group with a Total: trailer, "w <group>" only that
+   group and no trailer, like the real servers do */
+static void cmd_who(CLIENT_REC *client, const char *args)
+{
+	GSList *tmp;
+	char group[20], *total;
+	int i, users;
+
+	if (*args != '\0') {
+		send_group_who(client, args);
+		return;
+	}
+
+	for (i = 0; i < opt_groups; i++) {
+		g_snprintf(group, sizeof(group), "%d", i + 1);
+		send_group_who(client, group);
+	}
+
+	/* groups only real clients are in */
+	users = opt_users;
+	for (tmp = clients; tmp != NULL; tmp = tmp->next) {
+		CLIENT_REC *rec = tmp->data;
+		char *end;
+		long num;
+
+		if (!rec->logged_in)
+			continue;
+		users++;
+
+		num = strtol(rec->group, &end, 10);
+		if (*end == '\0' && num >= 1 && num <= opt_groups)
+			continue;
+		send_group_who(client, rec->group);
+	}
+
+	total = g_strdup_printf("Total: %d users in %d groups",
+				users, opt_groups);
+	send_packet(client, 'i', "co", total, NULL);
+	g_free(total);
+}
+
+static void cmd_message(CLIENT_REC *client, const char *args)
+{
+	CLIENT_REC *target;
+	const char *text;
+	char *nick;
+
+	text = strchr(args, ' ');
+	if (text == NULL) {
+		send_packet(client, 'e', "No message given", NULL);
+		return;
+	}
+	nick = g_strndup(args, text - args);
+	text++;
+
+	target = client_find(nick);
+	if (target == NULL)
+		send_packet(client, 'e', "User not signed on", NULL);
+	else
+		send_packet(target, 'c', client->nick, text, NULL);
+	g_free(nick);
+}
+
+static void cmd_group(CLIENT_REC *client, const char *args)
+{
+	if (*args == '\0') {
+		send_packet(client, 'e', "Group name required", NULL);
+		return;
+	}
+
+	g_free(client->group);
+	client->group = g_strdup(args);
+	send_status(client, "Status", "You are now in group %s", args);
+}
+
+static void cmd_name(CLIENT_REC *client, const char *args)
+{
+	if (*args == '\0' || client_find(args) != NULL) {
+		send_packet(client, 'e', "Nickname already in use", NULL);
+		return;
+	}
+
+	send_status(client, "Name", "%s changed nickname to %s",
+		    client->nick, args);
+	g_free(client->nick);
+	client->nick = g_strdup(args);
+}
+
+static void handle_command(CLIENT_REC *client, char **fields)
+{
+	const char *args;
+
+	args = fields[1] != NULL ? fields[1] : "";
+	if (strcmp(fields[0], "w") == 0)
+		cmd_who(client, args);
+	else if (strcmp(fields[0], "m") == 0)
+		cmd_message(client, args);
+	else if (strcmp(fields[0], "g") == 0)
+		cmd_group(client, args);
+	else if (strcmp(fields[0], "name") == 0)
+		cmd_name(client, args);
+	else if (strcmp(fields[0], "topic") == 0) {
+		send_status(client, "Topic", "%s changed the topic to \"%s\"",
+			    client->nick, args);
+	} else if (strcmp(fields[0], "beep") != 0) {
+		send_packet(client, 'e', "Unsupported command", NULL);
+	}
+}
+
+static void handle_login(CLIENT_REC *client, char **fields)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (fields[i] == NULL) {
+			send_packet(client, 'e', "Invalid login", NULL);
+			return;
+		}
+	}
+
+	if (client_find(fields[1]) != NULL) {
+		send_packet(client, 'e', "Nickname already in use", NULL);
+		return;
+	}
+
+	client->nick = g_strdup(fields[1]);
+	client->group = g_strdup(*fields[2] != '\0' ? fields[2] : "1");
+	client->logged_in = TRUE;
+	client->started = g_get_monotonic_time();
+	client->next_ping = client->started;
+	client->sleep_until = client->started;
+
+	send_packet(client, 'a', NULL);
+	send_status(client, "Status", "You are now in group %s",
+		    client->group);
+}
+
+static void handle_packet(CLIENT_REC *client, char *data, int len)
+{
+	GSList *tmp;
+	char **fields;
+	gint64 sent;
+
+	interval_stats.packets_in++;
+	interval_stats.bytes_in += len;
+
+	fields = g_strsplit(data+1, "\001", -1);
+	if (fields[0] == NULL) {
+		g_strfreev(fields);
+		fields = g_new0(char *, 2);
+		fields[0] = g_strdup("");
+	}
+
+	if (!client->logged_in && *data != 'a') {
+		g_strfreev(fields);
+		return;
+	}
+
+	switch (*data) {
+	case 'a':
+		handle_login(client, fields);
+		break;
+	case 'b':
+		interval_stats.opens_in++;
+		for (tmp = clients; tmp != NULL; tmp = tmp->next) {
+			CLIENT_REC *rec = tmp->data;
+
+			if (rec != client && rec->logged_in &&
+			    g_ascii_strcasecmp(rec->group, client->group) == 0)
+				send_packet(rec, 'b', client->nick,
+					    fields[0], NULL);
+		}
+		break;
+	case 'h':
+		handle_command(client, fields);
+		break;
+	case 'l':
+		send_packet(client, 'm', fields[0], NULL);
+		break;
+	case 'm':
+		/* pong to one of our pings, the id is when it was sent */
+		sent = g_ascii_strtoll(fields[0], NULL, 10);
+		if (sent > 0) {
+			stats_add_rtt(&interval_stats,
+				      g_get_monotonic_time() - sent);
+		}
+		break;
+	}
+
+	g_strfreev(fields);
+}
+
+/* Handle all complete packets in the client's input buffer */
+static void client_parse(CLIENT_REC *client)
+{
+	GString *packet;
+	unsigned char *buf;
+	int pos, len, size, last;
+
+	buf = (unsigned char *) client->inbuf->str;
+	len = client->inbuf->len;
+	packet = g_string_new(NULL);
+
+	pos = 0;
+	for (;;) {
+		/* check that the whole packet is there */
+		for (size = pos; size < len && buf[size] == 0; size += 256)
+			;
+		if (size >= len || size + buf[size] >= len)
+			break;
+
+		g_string_truncate(packet, 0);
+		do {
+			size = buf[pos];
+			last = size != 0;
+			if (!last)
+				size = 255;
+			g_string_append_len(packet, (char *) buf+pos+1, size);
+			pos += size+1;
+		} while (!last);
+
+		if (packet->len > 0)
+			handle_packet(client, packet->str, packet->len);
+	}
+
+	g_string_erase(client->inbuf, 0, pos);
+	g_string_free(packet, TRUE);
+}
+
+static void client_destroy(CLIENT_REC *client)
+{
+	clients = g_slist_remove(clients, client);
+
+	close(client->fd);
+	g_string_free(client->inbuf, TRUE);
+	g_string_free(client->outbuf, TRUE);
+	g_free(client->nick);
+	g_free(client->group);
+	g_free(client);
+}
+
+static void client_accept(int listen_fd)
+{
+	CLIENT_REC *client;
+	int fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd == -1)
+		return;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	client = g_new0(CLIENT_REC, 1);
+	client->fd = fd;
+	client->inbuf = g_string_sized_new(4096);
+	client->outbuf = g_string_sized_new(4096);
+	clients = g_slist_append(clients, client);
+
+	send_packet(client, 'j', "1", "localhost", "icb-fake-server", NULL);
+}
+
+/* Returns FALSE if the client disconnected */
+static int client_read(CLIENT_REC *client)
+{
+	char buf[16384];
+	int ret;
+
+	ret = read(client->fd, buf, sizeof(buf));
+	if (ret == 0 || (ret == -1 && errno != EAGAIN && errno != EINTR))
+		return FALSE;
+	if (ret > 0) {
+		g_string_append_len(client->inbuf, buf, ret);
+		client_parse(client);
+	}
+	return TRUE;
+}
+
+/* Returns FALSE if the client disconnected */
+static int client_write(CLIENT_REC *client)
+{
+	int ret;
+
+	if (client->outbuf->len == 0)
+		return TRUE;
+
+	ret = write(client->fd, client->outbuf->str, client->outbuf->len);
+	if (ret == -1)
+		return errno == EAGAIN || errno == EINTR;
+
+	g_string_erase(client->outbuf, 0, ret);
+	return TRUE;
+}
+
+static void send_fake_status(CLIENT_REC *client, unsigned long num)
+{
+	char nick[20];
+
+	/* fake users keep arriving and leaving */
+	g_snprintf(nick, sizeof(nick), "flood%lu", num / 2 % 10000);
+	if (num % 2 == 0) {
+		send_status(client, "Arrive",
+			    "%s (flood@fake.example.org) entered group", nick);
+	} else {
+		send_status(client, "Depart",
+			    "%s (flood@fake.example.org) just left", nick);
+	}
+}
+
+static void send_fake_open(CLIENT_REC *client, unsigned long num, int length)
+{
+	char nick[20], *text;
+	int i;
+
+	g_snprintf(nick, sizeof(nick), "user%lu", num % 50);
+	text = g_strdup_printf("%lu ", num);
+	i = strlen(text);
+	if (i < length) {
+		text = g_realloc(text, length + 1);
+		for (; i < length; i++)
+			text[i] = "abcdefghij klmnopqrst "[i % 22];
+		text[length] = '\0';
+	}
+
+	send_packet(client, 'b', nick, text, NULL);
+	g_free(text);
+}
+
+/* Send what's due of a flood of rate per second started at started, of
+   which sent have been sent already. Returns the new sent count. */
+static unsigned long flood_due(CLIENT_REC *client, int type, int rate,
+			       gint64 started, unsigned long sent,
+			       unsigned long max, gint64 now)
+{
+	unsigned long due;
+
+	due = (now - started) * rate / G_USEC_PER_SEC;
+	if (due > max)
+		due = max;
+
+	while (sent < due && client->outbuf->len < MAX_OUTBUF) {
+		if (type == 'd')
+			send_fake_status(client, sent);
+		else
+			send_fake_open(client, sent, opt_length);
+		sent++;
+	}
+	return sent;
+}
+
+/* Returns FALSE if the script wants the client disconnected */
+static int script_run(CLIENT_REC *client, gint64 now)
+{
+	char **args;
+	int ret;
+
+	if (client->flood_type != 0) {
+		client->flood_sent =
+			flood_due(client, client->flood_type,
+				  client->flood_rate, client->flood_started,
+				  client->flood_sent, client->flood_count, now);
+		if (client->flood_sent < client->flood_count)
+			return TRUE;
+		client->flood_type = 0;
+	}
+
+	ret = TRUE;
+	while (script[client->script_pos] != NULL &&
+	       now >= client->sleep_until && client->flood_type == 0 && ret) {
+		args = g_strsplit(script[client->script_pos++], " ", 3);
+		if (args[0] == NULL || *args[0] == '#' || *args[0] == '\0') {
+			g_strfreev(args);
+			continue;
+		}
+
+		if (strcmp(args[0], "sleep") == 0 && args[1] != NULL) {
+			client->sleep_until = now + atoi(args[1]) * 1000LL;
+		} else if (strcmp(args[0], "open") == 0 && args[1] != NULL) {
+			send_packet(client, 'b', args[1],
+				    args[2] != NULL ? args[2] : "", NULL);
+		} else if (strcmp(args[0], "personal") == 0 &&
+			   args[1] != NULL) {
+			send_packet(client, 'c', args[1],
+				    args[2] != NULL ? args[2] : "", NULL);
+		} else if (strcmp(args[0], "status") == 0 && args[1] != NULL) {
+			send_packet(client, 'd', args[1],
+				    args[2] != NULL ? args[2] : "", NULL);
+		} else if (strcmp(args[0], "error") == 0) {
+			char *text = g_strjoinv(" ", args+1);
+			send_packet(client, 'e', text, NULL);
+			g_free(text);
+		} else if (strcmp(args[0], "big") == 0 && args[1] != NULL) {
+			send_fake_open(client, 0, atoi(args[1]));
+		} else if (strcmp(args[0], "flood") == 0 && args[1] != NULL &&
+			   args[2] != NULL) {
+			client->flood_type =
+				strcmp(args[1], "status") == 0 ? 'd' : 'b';
+			client->flood_count = atoi(args[2]);
+			client->flood_rate = strchr(args[2], ' ') == NULL ?
+				1000 : atoi(strchr(args[2], ' ') + 1);
+			if (client->flood_rate <= 0)
+				client->flood_rate = 1000;
+			client->flood_sent = 0;
+			client->flood_started = now;
+		} else if (strcmp(args[0], "ping") == 0) {
+			char id[30];
+
+			g_snprintf(id, sizeof(id), "%" G_GINT64_FORMAT, now);
+			send_packet(client, 'l', id, NULL);
+		} else if (strcmp(args[0], "quit") == 0) {
+			ret = FALSE;
+		} else {
+			fprintf(stderr, "icb-fake-server: bad script line: "
+				"%s\n", script[client->script_pos-1]);
+		}
+		g_strfreev(args);
+	}
+	return ret;
+}
+
+/* Generate the floods and pings that are due. Returns FALSE if the client
+   should be disconnected. */
+static int client_tick(CLIENT_REC *client, gint64 now)
+{
+	char id[30];
+
+	if (!client->logged_in)
+		return TRUE;
+
+	if (opt_status_rate > 0) {
+		client->status_sent =
+			flood_due(client, 'd', opt_status_rate,
+				  client->started, client->status_sent,
+				  G_MAXLONG, now);
+	}
+	if (opt_open_rate > 0) {
+		client->open_sent =
+			flood_due(client, 'b', opt_open_rate,
+				  client->started, client->open_sent,
+				  G_MAXLONG, now);
+	}
+
+	if (opt_ping_interval > 0 && now >= client->next_ping) {
+		g_snprintf(id, sizeof(id), "%" G_GINT64_FORMAT, now);
+		send_packet(client, 'l', id, NULL);
+		client->next_ping = now + opt_ping_interval * 1000LL;
+	}
+
+	return script == NULL || script_run(client, now);
+}
+
+static int listen_socket(int port)
+{
+	struct sockaddr_in sin;
+	int fd, on;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) == -1 ||
+	    listen(fd, 16) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+static void sig_quit(int signo)
+{
+	quit = TRUE;
+}
+
+static void stats_merge(STATS_REC *dest, const STATS_REC *src)
+{
+	if (src->pongs > 0) {
+		if (dest->pongs == 0 || src->rtt_min < dest->rtt_min)
+			dest->rtt_min = src->rtt_min;
+		if (src->rtt_max > dest->rtt_max)
+			dest->rtt_max = src->rtt_max;
+	}
+	dest->rtt_total += src->rtt_total;
+	dest->pongs += src->pongs;
+	dest->packets_out += src->packets_out;
+	dest->bytes_out += src->bytes_out;
+	dest->packets_in += src->packets_in;
+	dest->bytes_in += src->bytes_in;
+	dest->opens_in += src->opens_in;
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd *fds;
+	GSList *tmp, *next;
+	gint64 now, started, last_report;
+	char *contents;
+	int c, i, port, listen_fd, count;
+
+	port = DEFAULT_PORT;
+	while ((c = getopt(argc, argv, "P:u:G:s:o:L:i:r:f:")) != -1) {
+		switch (c) {
+		case 'P':
+			port = atoi(optarg);
+			break;
+		case 'u':
+			opt_users = atoi(optarg);
+			break;
+		case 'G':
+			opt_groups = atoi(optarg);
+			break;
+		case 's':
+			opt_status_rate = atoi(optarg);
+			break;
+		case 'o':
+			opt_open_rate = atoi(optarg);
+			break;
+		case 'L':
+			opt_length = atoi(optarg);
+			break;
+		case 'i':
+			opt_ping_interval = atoi(optarg);
+			break;
+		case 'r':
+			opt_report = atoi(optarg);
+			break;
+		case 'f':
+			if (!g_file_get_contents(optarg, &contents,
+						 NULL, NULL)) {
+				fprintf(stderr, "icb-fake-server: can't read "
+					"%s\n", optarg);
+				return 1;
+			}
+			script = g_strsplit(contents, "\n", -1);
+			g_free(contents);
+			break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (optind != argc || opt_groups <= 0 || opt_users < 0) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	listen_fd = listen_socket(port);
+	if (listen_fd == -1) {
+		fprintf(stderr, "icb-fake-server: port %d: %s\n",
+			port, g_strerror(errno));
+		return 1;
+	}
+	printf("listening on 127.0.0.1:%d\n", port);
+	fflush(stdout);
+
+	signal(SIGINT, sig_quit);
+	signal(SIGTERM, sig_quit);
+	signal(SIGPIPE, SIG_IGN);
+
+	started = last_report = g_get_monotonic_time();
+	while (!quit) {
+		count = g_slist_length(clients) + 1;
+		fds = g_new0(struct pollfd, count);
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (tmp = clients, i = 1; tmp != NULL; tmp = tmp->next, i++) {
+			CLIENT_REC *client = tmp->data;
+
+			fds[i].fd = client->fd;
+			fds[i].events = POLLIN;
+			if (client->outbuf->len > 0)
+				fds[i].events |= POLLOUT;
+		}
+
+		/* wake up every millisecond to keep the floods smooth */
+		poll(fds, count, 1);
+		now = g_get_monotonic_time();
+
+		for (tmp = clients, i = 1; tmp != NULL; tmp = next, i++) {
+			CLIENT_REC *client = tmp->data;
+			int ok = TRUE;
+
+			next = tmp->next;
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				ok = client_read(client);
+			if (ok)
+				ok = client_tick(client, now);
+			if (ok)
+				ok = client_write(client);
+			if (!ok)
+				client_destroy(client);
+		}
+		if (fds[0].revents & POLLIN)
+			client_accept(listen_fd);
+		g_free(fds);
+
+		if (opt_report > 0 &&
+		    now - last_report >= opt_report * (gint64) G_USEC_PER_SEC) {
+			stats_print("interval", &interval_stats,
+				    (now - last_report) /
+				    (double) G_USEC_PER_SEC);
+			stats_merge(&stats, &interval_stats);
+			memset(&interval_stats, 0, sizeof(interval_stats));
+			last_report = now;
+		}
+	}
+
+	stats_merge(&stats, &interval_stats);
+	stats_print("total", &stats, (g_get_monotonic_time() - started) /
+		    (double) G_USEC_PER_SEC);
+
+	while (clients != NULL)
+		client_destroy(clients->data);
+	close(listen_fd);
+	g_strfreev(script);
+	return 0;
+}
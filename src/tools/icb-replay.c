@@ -0,0 +1,199 @@
+/*
+ icb-replay.c : feed a captured ICB session back through the protocol code
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <unistd.h>
+
+#include "module.h"
+
+#include "icb-servers.h"
+#include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-capture.h"
+#include "icb-directory.h"
+#include "icb-request.h"
+
+#include "stub-core.h"
+
+typedef struct {
+	gint64 time;
+	int direction;
+	int len;
+	unsigned char *data;
+} REPLAY_RECORD_REC;
+
+static const char *usage =
+	"usage: icb-replay [-p] [-n count] [-N nick] capture-file\n"
+	"  -p        replay at the recorded pace instead of full speed\n"
+	"  -n count  replay the capture count times\n"
+	"  -N nick   nick to replay as (default \"replay\")\n";
+
+static guint64 get_uint(const unsigned char *buf, int size)
+{
+	guint64 value;
+
+	for (value = 0; size > 0; size--, buf++)
+		value = (value << 8) | *buf;
+	return value;
+}
+
+/* Load all records of the capture in path, returns NULL if it isn't
+   a valid capture */
+static GArray *capture_load(const char *path)
+{
+	REPLAY_RECORD_REC rec;
+	GArray *records;
+	gchar *contents, *p, *end;
+	gsize size;
+	GError *error = NULL;
+
+	if (!g_file_get_contents(path, &contents, &size, &error)) {
+		fprintf(stderr, "icb-replay: %s\n", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	if (size < ICB_CAPTURE_MAGIC_LEN+1 ||
+	    memcmp(contents, ICB_CAPTURE_MAGIC, ICB_CAPTURE_MAGIC_LEN) != 0 ||
+	    contents[ICB_CAPTURE_MAGIC_LEN] != ICB_CAPTURE_VERSION) {
+		fprintf(stderr, "icb-replay: %s: not an ICB capture\n", path);
+		g_free(contents);
+		return NULL;
+	}
+
+	records = g_array_new(FALSE, FALSE, sizeof(REPLAY_RECORD_REC));
+	p = contents + ICB_CAPTURE_MAGIC_LEN+1;
+	end = contents + size;
+	while (end - p >= ICB_CAPTURE_HEADER_LEN) {
+		rec.time = get_uint((unsigned char *) p, 8);
+		rec.direction = p[8];
+		rec.len = get_uint((unsigned char *) p+9, 4);
+		p += ICB_CAPTURE_HEADER_LEN;
+		if (rec.len > end - p) {
+			fprintf(stderr, "icb-replay: %s: truncated\n", path);
+			break;
+		}
+
+		rec.data = g_malloc(rec.len);
+		memcpy(rec.data, p, rec.len);
+		g_array_append_val(records, rec);
+		p += rec.len;
+	}
+
+	g_free(contents);
+	return records;
+}
+
+int main(int argc, char **argv)
+{
+	ICB_SERVER_REC *server;
+	REPLAY_RECORD_REC *rec;
+	GArray *records;
+	const char *nick;
+	gint64 started, elapsed, wait;
+	unsigned long packets, bytes, sent;
+	int c, i, paced, count, round;
+
+	paced = FALSE;
+	count = 1;
+	nick = "replay";
+	while ((c = getopt(argc, argv, "pn:N:")) != -1) {
+		switch (c) {
+		case 'p':
+			paced = TRUE;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'N':
+			nick = optarg;
+			break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if (optind != argc-1 || count <= 0) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	records = capture_load(argv[optind]);
+	if (records == NULL)
+		return 1;
+
+	stub_core_init();
+	icb_protocol_init();
+	icb_sendq_init();
+	icb_directory_init();
+	icb_request_init();
+	server = stub_server_create(nick);
+
+	packets = bytes = sent = 0;
+	started = g_get_monotonic_time();
+	for (round = 0; round < count; round++) {
+		gint64 round_started = g_get_monotonic_time();
+
+		for (i = 0; i < records->len; i++) {
+			rec = &g_array_index(records, REPLAY_RECORD_REC, i);
+			if (rec->direction != ICB_CAPTURE_IN) {
+				sent++;
+				continue;
+			}
+
+			if (paced) {
+				wait = rec->time -
+					(g_get_monotonic_time() - round_started);
+				if (wait > 0)
+					g_usleep(wait);
+			}
+
+			packets += icb_protocol_feed(server, rec->data,
+						     rec->len);
+			bytes += rec->len;
+		}
+	}
+	elapsed = g_get_monotonic_time() - started;
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	printf("records:   %u (%lu sent by the original client)\n",
+	       records->len * count, sent);
+	printf("received:  %lu bytes, %lu packets\n", bytes, packets);
+	printf("signals:   %lu emitted\n", stub_signal_emits);
+	printf("replied:   %lu bytes\n", stub_sent_bytes);
+	printf("elapsed:   %.3f s\n", elapsed / 1000000.0);
+	if (packets > 0) {
+		printf("rate:      %.0f packets/s, %.1f MB/s\n",
+		       packets * 1000000.0 / elapsed,
+		       bytes / (double) elapsed);
+		printf("cost:      %.0f ns/packet\n",
+		       elapsed * 1000.0 / packets);
+	}
+
+	stub_server_destroy(server);
+	icb_request_deinit();
+	icb_directory_deinit();
+	icb_sendq_deinit();
+	icb_protocol_deinit();
+	stub_core_deinit();
+
+	for (i = 0; i < records->len; i++)
+		g_free(g_array_index(records, REPLAY_RECORD_REC, i).data);
+	g_array_free(records, TRUE);
+	return 0;
+}
@@ -0,0 +1,582 @@
+/*
+ stub-core.c : minimal irssi core for the ICB tools
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "modules.h"
+#include "signals.h"
+#include "commands.h"
+#include "settings.h"
+#include "misc.h"
+#include "rawlog.h"
+#include "network.h"
+#include "net-sendbuffer.h"
+#include "nicklist.h"
+
+#include "icb-servers.h"
+#include "icb-channels.h"
+#include "icb-protocol.h"
+#include "icb-sendq.h"
+#include "icb-stats.h"
+
+#include "stub-core.h"
+
+typedef struct {
+	int priority;
+	SIGNAL_FUNC func;
+	void *user_data;
+} STUB_HOOK_REC;
+
+GSList *servers;
+
+unsigned long stub_signal_emits;
+unsigned long stub_sent_bytes;
+
+static GHashTable *signal_ids;	/* name -> id */
+static GPtrArray *signal_hooks;	/* id -> GSList of STUB_HOOK_REC */
+static int signal_stopped;
+
+static GHashTable *settings;	/* key -> default value */
+
+/* signals */
+
+int module_get_uniq_id_str(const char *module, const char *id)
+{
+	gpointer value;
+
+	value = g_hash_table_lookup(signal_ids, id);
+	if (value != NULL)
+		return GPOINTER_TO_INT(value);
+
+	g_ptr_array_add(signal_hooks, NULL);
+	g_hash_table_insert(signal_ids, g_strdup(id),
+			    GINT_TO_POINTER(signal_hooks->len-1));
+	return signal_hooks->len-1;
+}
+
+static int hook_cmp(const STUB_HOOK_REC *a, const STUB_HOOK_REC *b)
+{
+	return a->priority - b->priority;
+}
+
+void signal_add_full(const char *module, int priority, const char *signal,
+		     SIGNAL_FUNC func, void *user_data)
+{
+	STUB_HOOK_REC *rec;
+	int id;
+
+	id = module_get_uniq_id_str("signals", signal);
+
+	rec = g_new0(STUB_HOOK_REC, 1);
+	rec->priority = priority;
+	rec->func = func;
+	rec->user_data = user_data;
+	signal_hooks->pdata[id] =
+		g_slist_insert_sorted(signal_hooks->pdata[id], rec,
+				      (GCompareFunc) hook_cmp);
+}
+
+void signal_remove_full(const char *signal, SIGNAL_FUNC func, void *data)
+{
+	GSList *tmp;
+	int id;
+
+	id = module_get_uniq_id_str("signals", signal);
+	for (tmp = signal_hooks->pdata[id]; tmp != NULL; tmp = tmp->next) {
+		STUB_HOOK_REC *rec = tmp->data;
+
+		if (rec->func == func && rec->user_data == data) {
+			signal_hooks->pdata[id] =
+				g_slist_remove(signal_hooks->pdata[id], rec);
+			g_free(rec);
+			break;
+		}
+	}
+}
+
+static int signal_emit_va(int id, int params, va_list va)
+{
+	gconstpointer args[6];
+	GSList *tmp;
+	int i, stopped;
+
+	stub_signal_emits++;
+	if (id < 0 || id >= (int) signal_hooks->len ||
+	    signal_hooks->pdata[id] == NULL)
+		return FALSE;
+
+	for (i = 0; i < 6; i++)
+		args[i] = i < params ? va_arg(va, gconstpointer) : NULL;
+
+	stopped = signal_stopped;
+	signal_stopped = FALSE;
+	for (tmp = signal_hooks->pdata[id]; tmp != NULL; tmp = tmp->next) {
+		STUB_HOOK_REC *rec = tmp->data;
+
+		if (params < 6)
+			args[params] = rec->user_data;
+		rec->func(args[0], args[1], args[2], args[3], args[4], args[5]);
+		if (signal_stopped)
+			break;
+	}
+	signal_stopped = stopped;
+	return TRUE;
+}
+
+int signal_emit(const char *signal, int params, ...)
+{
+	va_list va;
+	int ret;
+
+	va_start(va, params);
+	ret = signal_emit_va(module_get_uniq_id_str("signals", signal),
+			     params, va);
+	va_end(va);
+	return ret;
+}
+
+int signal_emit_id(int signal_id, int params, ...)
+{
+	va_list va;
+	int ret;
+
+	va_start(va, params);
+	ret = signal_emit_va(signal_id, params, va);
+	va_end(va);
+	return ret;
+}
+
+void signal_stop(void)
+{
+	signal_stopped = TRUE;
+}
+
+/* commands - never run, but the modules bind some */
+
+void command_bind_full(const char *module, int priority, const char *cmd,
+		       int protocol, const char *category, SIGNAL_FUNC func,
+		       void *user_data)
+{
+}
+
+void command_unbind_full(const char *cmd, SIGNAL_FUNC func, void *user_data)
+{
+}
+
+void command_set_options_module(const char *module, const char *cmd,
+				const char *options)
+{
+}
+
+void command_runsub(const char *cmd, const char *data,
+		    void *server, void *item)
+{
+}
+
+int cmd_get_params(const char *data, gpointer *free_me, int count, ...)
+{
+	return FALSE;
+}
+
+void cmd_params_free(void *free_me)
+{
+}
+
+char *convert_home(const char *path)
+{
+	return g_strdup(path);
+}
+
+/* settings - always the default value */
+
+static void setting_add(const char *key, const char *def)
+{
+	g_hash_table_insert(settings, g_strdup(key), g_strdup(def));
+}
+
+void settings_add_str_module(const char *module, const char *section,
+			     const char *key, const char *def)
+{
+	setting_add(key, def);
+}
+
+void settings_add_int_module(const char *module, const char *section,
+			     const char *key, int def)
+{
+	char num[MAX_INT_STRLEN];
+
+	g_snprintf(num, sizeof(num), "%d", def);
+	setting_add(key, num);
+}
+
+void settings_add_bool_module(const char *module, const char *section,
+			      const char *key, int def)
+{
+	setting_add(key, def ? "yes" : "no");
+}
+
+void settings_add_time_module(const char *module, const char *section,
+			      const char *key, const char *def)
+{
+	setting_add(key, def);
+}
+
+void settings_add_size_module(const char *module, const char *section,
+			      const char *key, const char *def)
+{
+	setting_add(key, def);
+}
+
+void settings_remove(const char *key)
+{
+	g_hash_table_remove(settings, key);
+}
+
+const char *settings_get_str(const char *key)
+{
+	return g_hash_table_lookup(settings, key);
+}
+
+int settings_get_int(const char *key)
+{
+	const char *value;
+
+	value = settings_get_str(key);
+	return value == NULL ? 0 : atoi(value);
+}
+
+int settings_get_bool(const char *key)
+{
+	const char *value;
+
+	value = settings_get_str(key);
+	return value != NULL && g_ascii_toupper(*value) == 'Y';
+}
+
+/* number with an optional unit, eg. "20msecs", "256k" */
+static int setting_get_scaled(const char *key, int time)
+{
+	const char *value;
+	char *unit;
+	double num;
+
+	value = settings_get_str(key);
+	if (value == NULL)
+		return 0;
+
+	num = g_ascii_strtod(value, &unit);
+	while (*unit == ' ')
+		unit++;
+
+	if (time) {
+		/* milliseconds */
+		if (g_ascii_strncasecmp(unit, "ms", 2) == 0)
+			return num;
+		if (g_ascii_strncasecmp(unit, "min", 3) == 0)
+			return num * 60000;
+		if (g_ascii_strncasecmp(unit, "h", 1) == 0)
+			return num * 3600000;
+		if (g_ascii_strncasecmp(unit, "d", 1) == 0)
+			return num * 86400000;
+		return num * 1000;
+	}
+
+	switch (g_ascii_tolower(*unit)) {
+	case 'k':
+		return num * 1024;
+	case 'm':
+		return num * 1024 * 1024;
+	case 'g':
+		return num * 1024 * 1024 * 1024;
+	}
+	return num;
+}
+
+int settings_get_time(const char *key)
+{
+	return setting_get_scaled(key, TRUE);
+}
+
+int settings_get_size(const char *key)
+{
+	return setting_get_scaled(key, FALSE);
+}
+
+/* network - there is no network */
+
+int net_receive(GIOChannel *handle, char *buf, int len)
+{
+	return 0;
+}
+
+GIOChannel *net_sendbuffer_handle(NET_SENDBUF_REC *rec)
+{
+	return NULL;
+}
+
+int net_transmit(GIOChannel *handle, const char *data, int len)
+{
+	stub_sent_bytes += len;
+	return len;
+}
+
+int g_input_add(GIOChannel *source, int condition,
+		GInputFunction function, void *data)
+{
+	return 0;
+}
+
+void rawlog_input(RAWLOG_REC *rawlog, const char *str)
+{
+}
+
+void rawlog_output(RAWLOG_REC *rawlog, const char *str)
+{
+}
+
+/* modules */
+
+void module_register_full(const char *name, const char *submodule,
+			  const char *defined_module_name)
+{
+}
+
+void *module_check_cast(void *object, int type_pos, const char *id)
+{
+	return object;
+}
+
+void *module_check_cast_module(void *object, int type_pos,
+			       const char *module, const char *id)
+{
+	return object;
+}
+
+/* nicklist - one nick per name, no nick->next chains */
+
+unsigned int g_istr_hash(gconstpointer v)
+{
+	const char *nick;
+	guint h;
+
+	for (nick = v, h = 0; *nick != '\0'; nick++)
+		h = (h << 5) - h + g_ascii_toupper(*nick);
+	return h;
+}
+
+int g_istr_equal(gconstpointer v, gconstpointer v2)
+{
+	return g_ascii_strcasecmp(v, v2) == 0;
+}
+
+static void nick_free(NICK_REC *nick)
+{
+	g_free(nick->nick);
+	g_free(nick->host);
+	g_free(nick);
+}
+
+void nicklist_insert(CHANNEL_REC *channel, NICK_REC *nick)
+{
+	NICK_REC *old;
+
+	old = g_hash_table_lookup(channel->nicks, nick->nick);
+	if (old != NULL)
+		nicklist_remove(channel, old);
+
+	g_hash_table_insert(channel->nicks, nick->nick, nick);
+	signal_emit("nicklist new", 2, channel, nick);
+}
+
+void nicklist_remove(CHANNEL_REC *channel, NICK_REC *nick)
+{
+	signal_emit("nicklist remove", 2, channel, nick);
+	g_hash_table_remove(channel->nicks, nick->nick);
+	nick_free(nick);
+}
+
+NICK_REC *nicklist_find(CHANNEL_REC *channel, const char *nick)
+{
+	return g_hash_table_lookup(channel->nicks, nick);
+}
+
+void nicklist_rename(SERVER_REC *server, const char *old_nick,
+		     const char *new_nick)
+{
+	CHANNEL_REC *channel;
+	NICK_REC *nick;
+	char *old;
+
+	channel = CHANNEL(((ICB_SERVER_REC *) server)->group);
+	nick = nicklist_find(channel, old_nick);
+	if (nick == NULL)
+		return;
+
+	g_hash_table_remove(channel->nicks, nick->nick);
+	old = nick->nick;
+	nick->nick = g_strdup(new_nick);
+	g_hash_table_insert(channel->nicks, nick->nick, nick);
+
+	signal_emit("nicklist changed", 3, channel, nick, old);
+	g_free(old);
+}
+
+static int nick_remove_all(void *key, NICK_REC *nick, void *data)
+{
+	nick_free(nick);
+	return TRUE;
+}
+
+static void nick_get(void *key, NICK_REC *nick, GSList **list)
+{
+	*list = g_slist_prepend(*list, nick);
+}
+
+GSList *nicklist_getnicks(CHANNEL_REC *channel)
+{
+	GSList *list;
+
+	list = NULL;
+	g_hash_table_foreach(channel->nicks, (GHFunc) nick_get, &list);
+	return list;
+}
+
+void stub_nicklist_clear(CHANNEL_REC *channel)
+{
+	g_hash_table_foreach_remove(channel->nicks,
+				    (GHRFunc) nick_remove_all, NULL);
+}
+
+/* servers */
+
+void server_change_nick(SERVER_REC *server, const char *nick)
+{
+	g_free(server->nick);
+	server->nick = g_strdup(nick);
+	signal_emit("server nick changed", 1, server);
+}
+
+int chat_protocol_lookup(const char *name)
+{
+	return 1;
+}
+
+void *chat_protocol_check_cast(void *object, int type_pos, const char *id)
+{
+	return object;
+}
+
+void server_disconnect(SERVER_REC *server)
+{
+	servers = g_slist_remove(servers, server);
+}
+
+ICB_SERVER_REC *stub_server_create(const char *nick)
+{
+	ICB_SERVER_CONNECT_REC *conn;
+	ICB_SERVER_REC *server;
+
+	conn = g_new0(ICB_SERVER_CONNECT_REC, 1);
+	conn->chat_type = ICB_PROTOCOL;
+	conn->address = g_strdup("localhost");
+	conn->port = 7326;
+	conn->nick = g_strdup(nick);
+	conn->username = g_strdup(nick);
+	conn->channels = g_strdup(DEFAULT_ICB_GROUP);
+
+	server = g_new0(ICB_SERVER_REC, 1);
+	server->chat_type = ICB_PROTOCOL;
+	server->connrec = conn;
+	server->tag = g_strdup("stub");
+	server->nick = g_strdup(nick);
+	server->connected = TRUE;
+
+	server->group = g_new0(ICB_CHANNEL_REC, 1);
+	server->group->chat_type = ICB_PROTOCOL;
+	server->group->name = g_strdup(DEFAULT_ICB_GROUP);
+	server->group->visible_name = g_strdup(DEFAULT_ICB_GROUP);
+	server->group->server = server;
+	server->group->nicks =
+		g_hash_table_new((GHashFunc) g_istr_hash, (GEqualFunc) g_istr_equal);
+
+	server->recvbuf_size = ICB_RECVBUF_SIZE;
+	server->recvbuf = g_malloc(server->recvbuf_size);
+	server->sendbuf_size = 256;
+	server->sendbuf = g_malloc(server->sendbuf_size);
+
+	/* no pacing, everything is written right away */
+	server->max_cmds_at_once = 1;
+	server->cmd_queue_speed = 0;
+	icb_sendq_create(server);
+	icb_stats_create(server);
+
+	servers = g_slist_append(servers, server);
+	return server;
+}
+
+void stub_server_destroy(ICB_SERVER_REC *server)
+{
+	ICB_SERVER_CONNECT_REC *conn;
+
+	signal_emit("server disconnected", 1, server);
+	servers = g_slist_remove(servers, server);
+	icb_sendq_destroy(server);
+	icb_stats_destroy(server);
+
+	stub_nicklist_clear(CHANNEL(server->group));
+	g_hash_table_destroy(server->group->nicks);
+	g_free(server->group->name);
+	g_free(server->group->visible_name);
+	g_free(server->group->topic);
+	g_free(server->group->topic_by);
+	g_free(server->group);
+
+	conn = server->connrec;
+	g_free(conn->address);
+	g_free(conn->nick);
+	g_free(conn->username);
+	g_free(conn->channels);
+	g_free(conn);
+
+	g_free(server->recvbuf);
+	g_free(server->sendbuf);
+	g_free(server->tag);
+	g_free(server->nick);
+	g_free(server);
+}
+
+void stub_core_init(void)
+{
+	signal_ids = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, NULL);
+	signal_hooks = g_ptr_array_new();
+	settings = g_hash_table_new_full(g_str_hash, g_str_equal,
+					 g_free, g_free);
+}
+
+void stub_core_deinit(void)
+{
+	int i;
+
+	for (i = 0; i < (int) signal_hooks->len; i++) {
+		g_slist_foreach(signal_hooks->pdata[i], (GFunc) g_free, NULL);
+		g_slist_free(signal_hooks->pdata[i]);
+	}
+	g_ptr_array_free(signal_hooks, TRUE);
+	g_hash_table_destroy(signal_ids);
+	g_hash_table_destroy(settings);
+}
@@ -0,0 +1,25 @@
+#ifndef __STUB_CORE_H
+#define __STUB_CORE_H
+
+/*
+ * Just enough of the irssi core for running the ICB protocol code outside
+ * of irssi. Signals are really dispatched, settings return their defaults,
+ * nicklists are kept in the channel's nick hash and everything that would
+ * be sent to the server or printed (stub-fe.c) is counted and thrown away.
+ */
+
+extern unsigned long stub_signal_emits;
+extern unsigned long stub_sent_bytes;
+extern unsigned long stub_printed;
+
+/* Create a connected ICB server record with nick, not attached to any
+   socket. It's in the default group, with an empty nicklist. */
+ICB_SERVER_REC *stub_server_create(const char *nick);
+void stub_server_destroy(ICB_SERVER_REC *server);
+
+void stub_nicklist_clear(CHANNEL_REC *channel);
+
+void stub_core_init(void);
+void stub_core_deinit(void);
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ stub-fe.c : minimal irssi fe-common/core for the ICB tools
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "module.h"
+#include "formats.h"
+#include "printtext.h"
+#include "themes.h"
+
+#include "icb-servers.h"
+
+#include "stub-core.h"
+
+/* nothing is printed, only counted */
+unsigned long stub_printed;
+
+void printformat_module(const char *module, void *server, const char *target,
+			int level, int formatnum, ...)
+{
+	stub_printed++;
+}
+
+void printtext(void *server, const char *target, int level,
+	       const char *text, ...)
+{
+	stub_printed++;
+}
+
+void theme_register_module(const char *module, FORMAT_REC *formats)
+{
+}